@@ -0,0 +1,92 @@
+/**
+  *******************************************************
+  * @file           : Autotuner.h
+  * @author         : Mebius
+  * @brief          : time candidate kernels once per shape and cache the winners on disk
+  * @date           : 2024/3/17
+  *******************************************************
+  */
+
+
+#ifndef WONTON_AUTOTUNER_H
+#define WONTON_AUTOTUNER_H
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace wonton {
+    class Autotuner {
+    public:
+        struct Candidate {
+            std::string name;               // stable name, this is what the cache stores
+            std::function<void()> run;      // one run of the kernel on a representative input
+        };
+
+        /**
+         * @brief construct an autotuner backed by a cache file
+         * @param cache_path : loaded now and rewritten after every tuning, empty for a memory-only cache
+         */
+        explicit Autotuner(std::string cache_path = "");
+
+        /**
+         * @brief the process-wide autotuner
+         * its cache file is $WONTON_TUNING_CACHE, without it the winners are only kept in memory.
+         * Setting $WONTON_AUTOTUNE=0 disables timing and always returns the fallback.
+         * @return
+         */
+        static Autotuner &global();
+
+        /**
+         * @brief return the index of the fastest candidate for an operator shape
+         * the candidates are timed on the first call for (cpu model, op, shape), later calls and
+         * later processes on the same host reuse the cached winner.
+         * @param op : operator name
+         * @param shape : key describing the shape and parameters of the call
+         * @param candidates
+         * @param fallback : returned when tuning is disabled
+         * @return
+         */
+        size_t select(const std::string &op, const std::string &shape,
+                      const std::vector<Candidate> &candidates, size_t fallback = 0);
+
+        /**
+         * @brief enable or disable timing
+         * @param enabled
+         */
+        void set_enabled(bool enabled);
+        /**
+         * @brief return the number of cached winners
+         * @return
+         */
+        size_t cache_size() const;
+        /**
+         * @brief forget all cached winners (the cache file is left untouched)
+         */
+        void clear();
+
+        /**
+         * @brief return the model name of this cpu, part of every cache key
+         * @return
+         */
+        static const std::string &cpu_model();
+
+    private:
+        struct Entry {
+            std::string name;
+            double time_ms = 0.;
+        };
+
+        void load();
+        void save() const;
+
+        std::string cache_path_;
+        bool enabled_ = true;
+        std::map<std::string, Entry> cache_;   // "cpu \t op \t shape" -> winner
+        mutable std::mutex mutex_;
+    };
+}
+
+#endif //WONTON_AUTOTUNER_H
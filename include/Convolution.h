@@ -0,0 +1,121 @@
+/**
+  *******************************************************
+  * @file           : Convolution.h
+  * @author         : Mebius
+  * @brief          : 2d convolution kernels and autotuned dispatch
+  * @date           : 2024/3/17
+  *******************************************************
+  */
+
+
+#ifndef WONTON_CONVOLUTION_H
+#define WONTON_CONVOLUTION_H
+
+#include <Autotuner.h>
+#include <Tensor.h>
+#include <string>
+#include <vector>
+
+namespace wonton {
+    struct ConvParams {
+        uint32_t stride_h = 1;
+        uint32_t stride_w = 1;
+        uint32_t pad_h = 0;     // zero padding on the top and the bottom
+        uint32_t pad_w = 0;     // zero padding on the left and the right
+    };
+
+    enum class ConvAlgorithm {
+        kDirect,        // loop over the output, one output channel per task
+        kTiled,         // direct on the plain layout, the output is walked in tile x tile blocks that stay in cache
+        kIm2col,        // unfold the input and run a single GEMM
+        kWinograd,      // F(2x2, 3x3), only for 3x3 kernels with stride 1
+    };
+
+    struct ConvConfig {
+        ConvAlgorithm algorithm = ConvAlgorithm::kIm2col;
+        uint32_t tile = 16;     // output tile size of kTiled
+        uint32_t threads = 1;
+    };
+
+    /**
+     * @brief return a stable name of a config, e.g. "tiled/tile16/threads4"
+     * @param config
+     * @return
+     */
+    std::string to_string(const ConvConfig &config);
+
+    /**
+     * @brief check if an algorithm can run a convolution
+     * @param algorithm
+     * @param kernel_h
+     * @param kernel_w
+     * @param params
+     * @return
+     */
+    bool conv2d_supported(ConvAlgorithm algorithm, uint32_t kernel_h, uint32_t kernel_w, const ConvParams &params);
+
+    /**
+     * @brief 2d convolution with a fixed algorithm
+     * @param input : [channels, rows, cols]
+     * @param kernels : one [channels, kernel_h, kernel_w] tensor per output channel
+     * @param params : stride and padding
+     * @param config : algorithm, tile size and thread count
+     * @return [kernels, out_rows, out_cols]
+     */
+    ftensor conv2d(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params,
+                   const ConvConfig &config);
+    /**
+     * @brief 2d convolution, the config is picked by Autotuner::global() for this shape
+     * @param input : [channels, rows, cols]
+     * @param kernels : one [channels, kernel_h, kernel_w] tensor per output channel
+     * @param params : stride and padding
+     * @return [kernels, out_rows, out_cols]
+     */
+    ftensor conv2d(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params);
+    /**
+     * @brief 2d convolution, the config is picked by the given autotuner for this shape
+     * @param input : [channels, rows, cols]
+     * @param kernels : one [channels, kernel_h, kernel_w] tensor per output channel
+     * @param params : stride and padding
+     * @param tuner
+     * @return [kernels, out_rows, out_cols]
+     */
+    ftensor conv2d(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params,
+                   Autotuner &tuner);
+
+    /**
+     * @brief return the [rows, cols] of the output of a convolution
+     * @param input : [channels, rows, cols]
+     * @param kernel_h
+     * @param kernel_w
+     * @param params
+     * @return
+     */
+    std::vector<uint32_t> conv2d_output_shape(const ftensor &input, uint32_t kernel_h, uint32_t kernel_w,
+                                              const ConvParams &params);
+
+    /**
+     * @brief unfold the windows of a convolution into one matrix
+     * row (oc * out_rows + orow) is the window of that output pixel, column ((c * kernel_w + kc) * kernel_h + kr)
+     * is one kernel position, the same order as the memory of a [channels, kernel_h, kernel_w] kernel
+     * @param input : [channels, rows, cols]
+     * @param kernel_h
+     * @param kernel_w
+     * @param params
+     * @param threads
+     * @return [out_rows * out_cols, channels * kernel_h * kernel_w]
+     */
+    arma::fmat im2col(const ftensor &input, uint32_t kernel_h, uint32_t kernel_w, const ConvParams &params,
+                      uint32_t threads = 1);
+
+    /**
+     * @brief return the configs the autotuner times for a convolution
+     * @param kernel_h
+     * @param kernel_w
+     * @param params
+     * @return
+     */
+    std::vector<ConvConfig> conv2d_candidates(uint32_t kernel_h, uint32_t kernel_w, const ConvParams &params);
+}
+
+#endif //WONTON_CONVOLUTION_H
@@ -0,0 +1,72 @@
+/**
+  *******************************************************
+  * @file           : Linear.h
+  * @author         : Mebius
+  * @brief          : fully-connected operator with packed weights
+  * @date           : 2024/3/21
+  *******************************************************
+  */
+
+
+#ifndef WONTON_LINEAR_H
+#define WONTON_LINEAR_H
+
+#include <Memory.h>
+#include <Parallel.h>
+#include <Tensor.h>
+#include <vector>
+
+namespace wonton {
+    /**
+     * @brief y = x * W^T + b
+     * the weights are packed once into panels of kPanel output features, interleaved along
+     * the input features, so that every kernel streams them contiguously and computes
+     * kPanel outputs per SIMD register.
+     */
+    class Linear {
+    public:
+        static constexpr uint32_t kPanel = 8;       // output features per panel
+        static constexpr uint32_t kBlock = 4;       // samples per GEMM micro kernel
+
+        /**
+         * @brief pack the weights
+         * @param weights : [out_features, in_features]
+         * @param bias : [out_features], an empty tensor for no bias
+         * @param threads : threads over the output features
+         */
+        explicit Linear(const ftensor &weights, const ftensor &bias = ftensor(),
+                        uint32_t threads = hardware_threads());
+
+        /**
+         * @brief run the layer
+         * @param input : [batch, in_features] or [in_features] for a single sample
+         * @return [batch, out_features] or [out_features]
+         */
+        ftensor forward(const ftensor &input) const;
+
+        uint32_t in_features() const;
+        uint32_t out_features() const;
+        /**
+         * @brief batches up to this size run the GEMV kernel once per sample, larger ones the blocked GEMM
+         * @param batch
+         */
+        void set_gemv_max_batch(uint32_t batch);
+        void set_threads(uint32_t threads);
+
+    private:
+        void gemv(const float *input, uint32_t batch, float *output) const;
+        void gemm(const float *input, uint32_t batch, float *output) const;
+        uint32_t threads_for(uint32_t batch) const;
+
+        uint32_t in_features_ = 0;
+        uint32_t out_features_ = 0;
+        uint32_t panels_ = 0;
+        uint32_t threads_ = 1;
+        uint32_t gemv_max_batch_ = 1;
+        std::vector<float> packed_;     // panel p, input k, lane r -> packed_[(p * in + k) * kPanel + r]
+        std::vector<float> bias_;       // padded to panels_ * kPanel
+        TrackedBytes packed_bytes_;
+    };
+}
+
+#endif //WONTON_LINEAR_H
@@ -0,0 +1,131 @@
+/**
+  *******************************************************
+  * @file           : Memory.h
+  * @author         : Mebius
+  * @brief          : memory accounting of tensors and operator buffers
+  * @date           : 2024/3/22
+  *******************************************************
+  */
+
+
+#ifndef WONTON_MEMORY_H
+#define WONTON_MEMORY_H
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+namespace wonton {
+    struct MemoryStats {
+        uint64_t live_bytes = 0;
+        uint64_t peak_bytes = 0;            // highest live_bytes since start or reset_peak()
+        uint64_t allocations = 0;
+        uint64_t allocated_bytes = 0;       // total, including released buffers
+        uint64_t largest_transient = 0;     // largest amount allocated and released again inside one outermost
+                                            // scope of a thread, kept with the scopes disabled
+    };
+
+    /**
+     * @brief what one named scope caused, summed over all its calls
+     * nested scopes are inclusive: the allocations of an inner scope also count for the outer ones
+     */
+    struct ScopeMemoryStats {
+        uint64_t calls = 0;
+        uint64_t allocations = 0;
+        uint64_t allocated_bytes = 0;
+        uint64_t peak_bytes = 0;            // highest growth of the live bytes during one call
+        uint64_t largest_transient = 0;     // peak minus what the call kept
+        int64_t retained_bytes = 0;         // allocated minus released, summed over the calls
+    };
+
+    /**
+     * @brief process-wide byte counters of the tensor buffers and the operator scratch buffers
+     * the global counters are always kept. A tensor buffer is recorded with the size it has when a
+     * tensor method creates or writes it, so a cube resized through the non-const data() is only
+     * re-recorded at the next non-const access of that tensor.
+     */
+    class MemoryTracker {
+    public:
+        /**
+         * @brief record a buffer, called by the tensor storage and the operator scratch buffers
+         * @param bytes
+         */
+        static void allocate(uint64_t bytes);
+        static void release(uint64_t bytes);
+
+        /**
+         * @brief return the global counters
+         * @return
+         */
+        static MemoryStats stats();
+        /**
+         * @brief return the counters of every scope name
+         * @return
+         */
+        static std::map<std::string, ScopeMemoryStats> scope_stats();
+        /**
+         * @brief enable or disable the per-scope counters, off unless $WONTON_MEMORY_SCOPES=1
+         * a disabled MemoryScope only updates thread-local counters, an enabled one takes a process-wide lock when it ends
+         * @param enabled
+         */
+        static void set_scopes_enabled(bool enabled);
+        static bool scopes_enabled();
+        /**
+         * @brief set the peak to the current live bytes
+         */
+        static void reset_peak();
+        /**
+         * @brief clear all counters except the live bytes
+         */
+        static void reset();
+        /**
+         * @brief write the global and per-scope counters as a table
+         * @param stream
+         */
+        static void dump(std::ostream &stream);
+        /**
+         * @brief log dump() through LOG(INFO)
+         */
+        static void report();
+    };
+
+    /**
+     * @brief attribute the allocations of this thread to a name until the scope ends
+     * if the scopes are disabled when it starts, it only feeds MemoryStats::largest_transient
+     */
+    class MemoryScope {
+    public:
+        explicit MemoryScope(const char *name);
+        MemoryScope(const MemoryScope &) = delete;
+        MemoryScope &operator=(const MemoryScope &) = delete;
+        ~MemoryScope();
+
+    private:
+        friend class MemoryTracker;
+        const char *name_;
+        bool active_;
+        int64_t live_ = 0;          // growth of the live bytes since the scope started
+        uint64_t peak_ = 0;
+        uint64_t allocations_ = 0;
+        uint64_t allocated_bytes_ = 0;
+        MemoryScope *parent_;
+    };
+
+    /**
+     * @brief a scratch buffer that is not a tensor, recorded while this object lives
+     */
+    class TrackedBytes {
+    public:
+        explicit TrackedBytes(uint64_t bytes = 0);
+        TrackedBytes(const TrackedBytes &other);
+        TrackedBytes(TrackedBytes &&other) noexcept;
+        TrackedBytes &operator=(TrackedBytes other) noexcept;
+        ~TrackedBytes();
+
+    private:
+        uint64_t bytes_;
+    };
+}
+
+#endif //WONTON_MEMORY_H
@@ -0,0 +1,60 @@
+/**
+  *******************************************************
+  * @file           : Parallel.h
+  * @author         : Mebius
+  * @brief          : split a loop over a fixed number of threads
+  * @date           : 2024/3/17
+  *******************************************************
+  */
+
+
+#ifndef WONTON_PARALLEL_H
+#define WONTON_PARALLEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+namespace wonton {
+    /**
+     * @brief return the number of hardware threads, at least 1
+     * @return
+     */
+    inline uint32_t hardware_threads() {
+        return std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    /**
+     * @brief run fn(begin_i, end_i) on contiguous chunks of [begin, end)
+     * @param begin
+     * @param end
+     * @param threads : number of threads, the calling thread runs the last chunk
+     * @param fn
+     */
+    inline void parallel_for(uint32_t begin, uint32_t end, uint32_t threads,
+                             const std::function<void(uint32_t, uint32_t)> &fn) {
+        if (end <= begin) {
+            return;
+        }
+        const uint32_t total = end - begin;
+        threads = std::max(1u, std::min(threads, total));
+        if (threads == 1) {
+            fn(begin, end);
+            return;
+        }
+        const uint32_t chunk = (total + threads - 1) / threads;
+        std::vector<std::thread> workers;
+        uint32_t start = begin;
+        for (uint32_t t = 0; t + 1 < threads && start + chunk < end; ++t, start += chunk) {
+            workers.emplace_back(fn, start, start + chunk);
+        }
+        fn(start, end);
+        for (auto &worker: workers) {
+            worker.join();
+        }
+    }
+}
+
+#endif //WONTON_PARALLEL_H
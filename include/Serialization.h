@@ -0,0 +1,87 @@
+/**
+  *******************************************************
+  * @file           : Serialization.h
+  * @author         : Mebius
+  * @brief          : binary tensor format with chunked streaming and optional compression
+  * @date           : 2024/3/18
+  *******************************************************
+  */
+
+
+#ifndef WONTON_SERIALIZATION_H
+#define WONTON_SERIALIZATION_H
+
+#include <Tensor.h>
+#include <iosfwd>
+#include <string>
+
+namespace wonton {
+    /**
+     * layout of a serialized tensor, all integers are little endian:
+     *   header  : "WTNS", version, dtype, layout, compression, rank, raw shape[3], rows, cols, channels, chunk bytes
+     *   chunks  : { uint32 raw bytes, uint32 stored bytes, stored bytes of payload } ...
+     * the payload is the column-major cube data, the same order as arma::fcube::memptr().
+     * A chunk whose stored bytes equal its raw bytes is not compressed.
+     */
+    enum class Compression : uint8_t {
+        kNone = 0,
+        kZstd = 1,
+        kLz4 = 2,
+    };
+
+    struct SaveOptions {
+        Compression compression = Compression::kNone;
+        int level = 1;                  // compression level, zstd only
+        uint32_t chunk_bytes = 1u << 20;
+    };
+
+    /**
+     * @brief check if a compression is built in, see WONTON_WITH_ZSTD and WONTON_WITH_LZ4
+     * @param compression
+     * @return
+     */
+    bool compression_available(Compression compression);
+
+    /**
+     * @brief write a tensor to a stream, several tensors can be written one after another
+     * @param tensor
+     * @param stream
+     * @param options : an unavailable compression falls back to kNone
+     */
+    void save_tensor(const ftensor &tensor, std::ostream &stream, const SaveOptions &options = SaveOptions());
+    /**
+     * @brief write a tensor to a file, the file is truncated
+     * @param tensor
+     * @param path
+     * @param options
+     */
+    void save_tensor(const ftensor &tensor, const std::string &path, const SaveOptions &options = SaveOptions());
+    /**
+     * @brief write a tensor to a file descriptor, e.g. a pipe or a socket
+     * @param tensor
+     * @param fd
+     * @param options
+     */
+    void save_tensor_fd(const ftensor &tensor, int fd, const SaveOptions &options = SaveOptions());
+
+    /**
+     * @brief read the next tensor from a stream
+     * @param stream
+     * @return
+     */
+    ftensor load_tensor(std::istream &stream);
+    /**
+     * @brief read the first tensor of a file
+     * @param path
+     * @return
+     */
+    ftensor load_tensor(const std::string &path);
+    /**
+     * @brief read the next tensor from a file descriptor
+     * @param fd
+     * @return
+     */
+    ftensor load_tensor_fd(int fd);
+}
+
+#endif //WONTON_SERIALIZATION_H
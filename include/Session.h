@@ -0,0 +1,124 @@
+/**
+  *******************************************************
+  * @file           : Session.h
+  * @author         : Mebius
+  * @brief          : in-process inference session with dynamic request batching
+  * @date           : 2024/3/16
+  *******************************************************
+  */
+
+
+#ifndef WONTON_SESSION_H
+#define WONTON_SESSION_H
+
+#include <Tensor.h>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace wonton {
+    /**
+     * @brief window in which single requests are coalesced into one batch
+     */
+    struct BatchOptions {
+        uint32_t max_batch_size = 8;                    // flush as soon as this many requests are queued
+        std::chrono::microseconds max_wait{1000};       // flush at the latest this long after the oldest request
+    };
+
+    /**
+     * @brief latency and throughput observed by a session
+     */
+    struct SessionStats {
+        uint64_t requests = 0;          // completed requests
+        uint64_t batches = 0;           // forward passes
+        double avg_batch_size = 0.;
+        double p50_latency_ms = 0.;     // submit -> result ready, within 5% (see InferenceSession::kLatencyBucketsPerOctave)
+        double p99_latency_ms = 0.;
+        double throughput = 0.;         // requests per second
+        uint64_t peak_memory_bytes = 0; // process wide, see MemoryTracker for the per-operator breakdown
+    };
+
+    class InferenceSession {
+    public:
+        /**
+         * @brief forward pass over a batch
+         * the inputs of batch_size requests are stacked along the channels, so request i owns
+         * channels [i * c, (i + 1) * c). The output must stack the results the same way.
+         */
+        using BatchFunction = std::function<ftensor(const ftensor &batch, uint32_t batch_size)>;
+
+        /**
+         * @brief start a session and its batching thread
+         * @param forward : forward pass over a batch
+         * @param options : batching window
+         */
+        explicit InferenceSession(BatchFunction forward, BatchOptions options = BatchOptions());
+        InferenceSession(const InferenceSession &) = delete;
+        InferenceSession &operator=(const InferenceSession &) = delete;
+        /**
+         * @brief drain the pending requests and stop the batching thread
+         */
+        ~InferenceSession();
+
+        /**
+         * @brief queue a single request
+         * @param input : one sample, all samples of a batch must share the same shape
+         * @return the result of this sample, scattered from the batched output. It holds a std::runtime_error
+         * if the session is stopped or the forward pass returns an output that can not be scattered,
+         * and the exception of the forward pass if it throws
+         */
+        std::future<ftensor> submit(ftensor input);
+        /**
+         * @brief stop accepting requests, finish the queued ones and join the batching thread
+         */
+        void stop();
+        /**
+         * @brief return the statistics since the session started or the last reset
+         * @return
+         */
+        SessionStats stats() const;
+        /**
+         * @brief clear the statistics
+         */
+        void reset_stats();
+
+        // latencies are counted in log-spaced buckets, so the stats take constant memory and time
+        static constexpr uint32_t kLatencyBucketsPerOctave = 8;
+        static constexpr uint32_t kLatencyBuckets = 32 * kLatencyBucketsPerOctave;     // 1us .. 2^32us
+
+    private:
+        using Clock = std::chrono::steady_clock;
+        struct Request {
+            ftensor input;
+            std::promise<ftensor> result;
+            Clock::time_point enqueue_time;
+        };
+
+        void run();
+        void process(std::vector<Request> &batch);
+
+        BatchFunction forward_;
+        BatchOptions options_;
+
+        std::mutex queue_mutex_;
+        std::condition_variable queue_cond_;
+        std::deque<Request> queue_;
+        bool stopping_ = false;
+        std::thread worker_;
+
+        mutable std::mutex stats_mutex_;
+        std::array<uint64_t, kLatencyBuckets> latency_buckets_{};
+        uint64_t requests_ = 0;
+        uint64_t batches_ = 0;
+        Clock::time_point first_enqueue_;
+        Clock::time_point last_complete_;
+    };
+}
+
+#endif //WONTON_SESSION_H
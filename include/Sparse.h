@@ -0,0 +1,156 @@
+/**
+  *******************************************************
+  * @file           : Sparse.h
+  * @author         : Mebius
+  * @brief          : sparse weight formats (CSR, block sparse) and their GEMM / convolution kernels
+  * @date           : 2024/3/20
+  *******************************************************
+  */
+
+
+#ifndef WONTON_SPARSE_H
+#define WONTON_SPARSE_H
+
+#include <Convolution.h>
+#include <Tensor.h>
+#include <vector>
+
+namespace wonton {
+    class CsrMatrix {
+    public:
+        CsrMatrix() = default;
+        /**
+         * @brief keep the elements whose magnitude is larger than threshold
+         * @param dense
+         * @param threshold
+         * @return
+         */
+        static CsrMatrix from_dense(const arma::fmat &dense, float threshold = 0.f);
+        /**
+         * @brief convert a 1 or 2 dim tensor
+         * @param tensor
+         * @param threshold
+         * @return
+         */
+        static CsrMatrix from_tensor(const ftensor &tensor, float threshold = 0.f);
+
+        uint32_t rows() const { return this->rows_; }
+        uint32_t cols() const { return this->cols_; }
+        /**
+         * @brief return the number of stored elements
+         * @return
+         */
+        uint32_t nnz() const { return static_cast<uint32_t>(this->values_.size()); }
+        /**
+         * @brief return the fraction of zero elements
+         * @return
+         */
+        float sparsity() const;
+        arma::fmat to_dense() const;
+
+        const std::vector<uint32_t> &row_offsets() const { return this->row_offsets_; }   // rows + 1 entries
+        const std::vector<uint32_t> &col_indices() const { return this->col_indices_; }
+        const std::vector<float> &values() const { return this->values_; }
+
+    private:
+        uint32_t rows_ = 0;
+        uint32_t cols_ = 0;
+        std::vector<uint32_t> row_offsets_;
+        std::vector<uint32_t> col_indices_;
+        std::vector<float> values_;
+    };
+
+    /**
+     * @brief CSR over block_rows x block_cols blocks, e.g. 1x4 or 4x4 for structured pruning
+     * a block is stored (row major, zeros included) when any of its elements is kept,
+     * the blocks on the right and bottom edges are padded with zeros
+     */
+    class BlockSparseMatrix {
+    public:
+        BlockSparseMatrix() = default;
+        /**
+         * @brief keep the blocks that hold an element whose magnitude is larger than threshold
+         * @param dense
+         * @param block_rows
+         * @param block_cols
+         * @param threshold
+         * @return
+         */
+        static BlockSparseMatrix from_dense(const arma::fmat &dense, uint32_t block_rows, uint32_t block_cols,
+                                            float threshold = 0.f);
+        /**
+         * @brief convert a 1 or 2 dim tensor
+         * @param tensor
+         * @param block_rows
+         * @param block_cols
+         * @param threshold
+         * @return
+         */
+        static BlockSparseMatrix from_tensor(const ftensor &tensor, uint32_t block_rows, uint32_t block_cols,
+                                             float threshold = 0.f);
+
+        uint32_t rows() const { return this->rows_; }
+        uint32_t cols() const { return this->cols_; }
+        uint32_t block_rows() const { return this->block_rows_; }
+        uint32_t block_cols() const { return this->block_cols_; }
+        /**
+         * @brief return the number of stored blocks
+         * @return
+         */
+        uint32_t blocks() const { return static_cast<uint32_t>(this->block_indices_.size()); }
+        /**
+         * @brief return the fraction of elements outside the stored blocks
+         * @return
+         */
+        float sparsity() const;
+        arma::fmat to_dense() const;
+
+        const std::vector<uint32_t> &block_offsets() const { return this->block_offsets_; }  // block rows + 1
+        const std::vector<uint32_t> &block_indices() const { return this->block_indices_; }  // block column
+        const std::vector<float> &values() const { return this->values_; }
+
+    private:
+        uint32_t rows_ = 0;
+        uint32_t cols_ = 0;
+        uint32_t block_rows_ = 1;
+        uint32_t block_cols_ = 1;
+        std::vector<uint32_t> block_offsets_;
+        std::vector<uint32_t> block_indices_;
+        std::vector<float> values_;
+    };
+
+    /**
+     * @brief sparse x dense matrix multiply
+     * @param a : [m, k]
+     * @param b : [k, n]
+     * @param threads : split over the columns of b
+     * @return [m, n]
+     */
+    arma::fmat spmm(const CsrMatrix &a, const arma::fmat &b, uint32_t threads = 1);
+    arma::fmat spmm(const BlockSparseMatrix &a, const arma::fmat &b, uint32_t threads = 1);
+
+    /**
+     * @brief stack convolution kernels into a [kernels, channels * kernel_h * kernel_w] matrix,
+     * the column order matches im2col
+     * @param kernels : one [channels, kernel_h, kernel_w] tensor per output channel
+     * @return
+     */
+    arma::fmat kernel_matrix(const std::vector<ftensor> &kernels);
+
+    /**
+     * @brief 2d convolution with sparse kernels
+     * @param input : [channels, rows, cols]
+     * @param kernels : kernel_matrix() of the kernels, pruned
+     * @param kernel_h
+     * @param kernel_w
+     * @param params : stride and padding
+     * @param threads : split over the output channels
+     * @return [kernels, out_rows, out_cols]
+     */
+    ftensor conv2d(const ftensor &input, const CsrMatrix &kernels, uint32_t kernel_h, uint32_t kernel_w,
+                   const ConvParams &params, uint32_t threads = 1);
+    ftensor conv2d(const ftensor &input, const BlockSparseMatrix &kernels, uint32_t kernel_h, uint32_t kernel_w,
+                   const ConvParams &params, uint32_t threads = 1);
+}
+
+#endif //WONTON_SPARSE_H
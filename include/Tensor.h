@@ -12,9 +12,23 @@
 #define WONTON_TENSOR_H
 
 #include <armadillo>
+#include <memory>
 #include <vector>
 
 namespace wonton{
+    /**
+     * @brief copy-on-write counters of all float tensors
+     */
+    struct CowStats {
+        uint64_t shared_copies = 0;     // copies that share the buffer instead of copying it
+        uint64_t deep_copies = 0;       // shared buffers copied because one side was mutated
+        /**
+         * @brief return the number of physical copies that never happened
+         * @return
+         */
+        uint64_t avoided_copies() const { return shared_copies > deep_copies ? shared_copies - deep_copies : 0; }
+    };
+
     template<typename T> class Tensor {};
 
     template<> class Tensor<double> {};
@@ -22,7 +36,7 @@ namespace wonton{
     public:
         /// constructors
         Tensor() = default; // default constructor
-        Tensor(const Tensor& ) = default; // copy constructor
+        Tensor(const Tensor& tensor); // copy constructor, shares the data until one side is mutated (see data())
         Tensor(Tensor&& ) = default; // move constructor
         /**
          * @brief Construct a Tensor of 1 dim
@@ -50,7 +64,7 @@ namespace wonton{
 
         /// member operator
         Tensor& operator=(Tensor&& ) = default; // move assignment
-        Tensor& operator=(const Tensor& ) = default; // copy assignment
+        Tensor& operator=(const Tensor& tensor); // copy assignment, shares the data until one side is mutated
 
         /// destructor
         ~Tensor() = default;
@@ -103,8 +117,12 @@ namespace wonton{
          * @param data
          */
         void set_data(const arma::fcube& data);
+        void set_data(arma::fcube&& data);
         /**
          * @brief get data values
+         * the non-const accessors below (data, slice, index, at) copy a shared buffer first and
+         * mark it unshareable: the reference they return may still be written through, so later
+         * copies of this tensor are deep for as long as it keeps this buffer
          * @return
          */
         arma::fcube& data();
@@ -177,12 +195,58 @@ namespace wonton{
          * @param padding_value : padding value
          */
         void padding(const std::vector<uint32_t>& pads,float padding_value);
+        /**
+         * @brief check if the data is shared with another tensor
+         * @return
+         */
+        bool shared() const;
 
-
+        /**
+         * @brief return the copy-on-write counters
+         * @return
+         */
+        static CowStats cow_stats();
+        /**
+         * @brief reset the copy-on-write counters
+         */
+        static void reset_cow_stats();
 
     private:
-        std::vector<uint32_t> raw_shape;     // original shape
-        arma::fcube raw_data;                // original data (always 3-dim)
+        /**
+         * @brief read access to the data, never copies
+         * @return
+         */
+        const arma::fcube& cube() const;
+        /**
+         * @brief write access to the data, copies it first if it is shared
+         * @return
+         */
+        arma::fcube& mutable_cube();
+        /**
+         * @brief write access to the data that is about to be overwritten entirely,
+         * a shared buffer is replaced by a new one without copying
+         * @return
+         */
+        arma::fcube& overwrite_cube();
+        /**
+         * @brief write access for a reference that leaves the tensor, later copies are deep
+         * @return
+         */
+        arma::fcube& exposed_cube();
+        /**
+         * @brief share or copy the data of another tensor
+         * @param tensor
+         */
+        void copy_from(const Tensor& tensor);
+        /**
+         * @brief check if this tensor is the only owner of its data, so it can be written in place
+         * @return
+         */
+        bool owns_cube() const;
+
+        std::vector<uint32_t> raw_shape;                // original shape
+        std::shared_ptr<arma::fcube> raw_data;          // original data (always 3-dim), shared between copies
+        bool unshareable = false;                       // a reference into raw_data was handed out
     };
     template<> class Tensor<uint8_t> {};    // 8-bit unsigned integer
     using ftensor = Tensor<float>;
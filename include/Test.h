@@ -14,5 +14,26 @@
 #include <Tensor.h>
 #include <gtest/gtest.h>
 #include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <limits>
+
+/**
+ * @brief return the fastest of several runs of a function in milliseconds
+ * @param fn
+ * @param runs
+ * @return
+ */
+inline double best_ms(const std::function<void()> &fn, uint32_t runs = 3) {
+    double best = std::numeric_limits<double>::max();
+    for (uint32_t i = 0; i < runs; ++i) {
+        const auto start = std::chrono::steady_clock::now();
+        fn();
+        best = std::min(best, std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count());
+    }
+    return best;
+}
 
 #endif //WONTON_TEST_H
@@ -0,0 +1,190 @@
+/**
+  *******************************************************
+  * @file           : Autotuner.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/17
+  *******************************************************
+  */
+
+#include <Autotuner.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace wonton {
+    namespace {
+        constexpr uint32_t kWarmupRuns = 1;
+        constexpr uint32_t kTimedRuns = 3;
+
+        std::string sanitize(std::string value) {
+            std::replace(value.begin(), value.end(), '\t', ' ');
+            std::replace(value.begin(), value.end(), '\n', ' ');
+            return value;
+        }
+
+        std::string make_key(const std::string &op, const std::string &shape) {
+            return Autotuner::cpu_model() + "\t" + sanitize(op) + "\t" + sanitize(shape);
+        }
+
+        double time_candidate(const Autotuner::Candidate &candidate) {
+            for (uint32_t i = 0; i < kWarmupRuns; ++i) {
+                candidate.run();
+            }
+            double best = std::numeric_limits<double>::max();
+            for (uint32_t i = 0; i < kTimedRuns; ++i) {
+                const auto start = std::chrono::steady_clock::now();
+                candidate.run();
+                const auto end = std::chrono::steady_clock::now();
+                best = std::min(best, std::chrono::duration<double, std::milli>(end - start).count());
+            }
+            return best;
+        }
+    }
+
+    Autotuner::Autotuner(std::string cache_path) : cache_path_(std::move(cache_path)) {
+        this->load();
+    }
+
+    Autotuner &Autotuner::global() {
+        static Autotuner *autotuner = [] {
+            const char *path = std::getenv("WONTON_TUNING_CACHE");
+            auto *tuner = new Autotuner(path != nullptr ? path : "");
+            const char *enabled = std::getenv("WONTON_AUTOTUNE");
+            if (enabled != nullptr && std::string(enabled) == "0") {
+                tuner->set_enabled(false);
+            }
+            return tuner;
+        }();
+        return *autotuner;
+    }
+
+    const std::string &Autotuner::cpu_model() {
+        static const std::string model = [] {
+            std::ifstream cpuinfo("/proc/cpuinfo");
+            std::string line;
+            while (std::getline(cpuinfo, line)) {
+                if (line.rfind("model name", 0) == 0) {
+                    const size_t colon = line.find(':');
+                    if (colon != std::string::npos) {
+                        const size_t start = line.find_first_not_of(' ', colon + 1);
+                        if (start != std::string::npos) {
+                            return sanitize(line.substr(start));
+                        }
+                    }
+                }
+            }
+            return std::string("unknown");
+        }();
+        return model;
+    }
+
+    size_t Autotuner::select(const std::string &op, const std::string &shape,
+                             const std::vector<Candidate> &candidates, size_t fallback) {
+        CHECK(!candidates.empty()) << "no candidate for " << op;
+        CHECK_LT(fallback, candidates.size());
+        if (candidates.size() == 1) {
+            return 0;
+        }
+
+        const std::string key = make_key(op, shape);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex_);
+            if (!this->enabled_) {
+                return fallback;
+            }
+            const auto iter = this->cache_.find(key);
+            if (iter != this->cache_.end()) {
+                for (size_t i = 0; i < candidates.size(); ++i) {
+                    if (candidates.at(i).name == iter->second.name) {
+                        return i;
+                    }
+                }
+                // the cached winner is not a candidate anymore, tune again
+            }
+        }
+
+        // time outside the lock, the candidates may take a while
+        size_t best = fallback;
+        double best_time = std::numeric_limits<double>::max();
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            const double time = time_candidate(candidates.at(i));
+            LOG(INFO) << "autotune " << op << " [" << shape << "] " << candidates.at(i).name << ": " << time << "ms";
+            if (time < best_time) {
+                best_time = time;
+                best = i;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->cache_[key] = Entry{candidates.at(best).name, best_time};
+        this->save();
+        return best;
+    }
+
+    void Autotuner::set_enabled(bool enabled) {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->enabled_ = enabled;
+    }
+
+    size_t Autotuner::cache_size() const {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        return this->cache_.size();
+    }
+
+    void Autotuner::clear() {
+        std::lock_guard<std::mutex> lock(this->mutex_);
+        this->cache_.clear();
+    }
+
+    // one line per winner: cpu model \t op \t shape \t candidate name \t time in ms
+    void Autotuner::load() {
+        if (this->cache_path_.empty()) {
+            return;
+        }
+        std::ifstream file(this->cache_path_);
+        std::string line;
+        while (std::getline(file, line)) {
+            std::vector<std::string> fields;
+            std::stringstream stream(line);
+            std::string field;
+            while (std::getline(stream, field, '\t')) {
+                fields.push_back(field);
+            }
+            if (fields.size() != 5) {
+                LOG(WARNING) << "skip malformed tuning cache line: " << line;
+                continue;
+            }
+            Entry entry;
+            entry.name = fields.at(3);
+            entry.time_ms = std::strtod(fields.at(4).c_str(), nullptr);
+            this->cache_[fields.at(0) + "\t" + fields.at(1) + "\t" + fields.at(2)] = entry;
+        }
+    }
+
+    void Autotuner::save() const {
+        if (this->cache_path_.empty()) {
+            return;
+        }
+        // write a sibling file and rename it, so a crash never leaves a truncated cache
+        const std::string temp_path = this->cache_path_ + ".tmp";
+        {
+            std::ofstream file(temp_path, std::ios::trunc);
+            if (!file) {
+                LOG(WARNING) << "can not write tuning cache " << temp_path;
+                return;
+            }
+            for (const auto &[key, entry]: this->cache_) {
+                file << key << "\t" << entry.name << "\t" << entry.time_ms << "\n";
+            }
+        }
+        if (std::rename(temp_path.c_str(), this->cache_path_.c_str()) != 0) {
+            LOG(WARNING) << "can not replace tuning cache " << this->cache_path_;
+        }
+    }
+}
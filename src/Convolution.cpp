@@ -0,0 +1,391 @@
+/**
+  *******************************************************
+  * @file           : Convolution.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/17
+  *******************************************************
+  */
+
+#include <Convolution.h>
+#include <Autotuner.h>
+#include <Memory.h>
+#include <Parallel.h>
+#include <glog/logging.h>
+#include <set>
+
+namespace wonton {
+    namespace {
+        // all kernels index the zero padded input, element (c, r, col) is at c * rows * cols + col * rows + r
+        struct ConvShape {
+            uint32_t channels, rows, cols;          // padded input
+            uint32_t kernels, kernel_h, kernel_w;
+            uint32_t out_rows, out_cols;
+            uint32_t stride_h, stride_w;
+        };
+
+        void conv_direct(const float *in, const std::vector<ftensor> &kernels, const ConvShape &s,
+                         float *out, uint32_t threads) {
+            const uint32_t plane = s.rows * s.cols;
+            const uint32_t out_plane = s.out_rows * s.out_cols;
+            parallel_for(0, s.kernels, threads, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t k = begin; k < end; ++k) {
+                    const float *kernel = kernels.at(k).data().memptr();
+                    float *out_k = out + k * out_plane;
+                    for (uint32_t c = 0; c < s.channels; ++c) {
+                        for (uint32_t kc = 0; kc < s.kernel_w; ++kc) {
+                            for (uint32_t kr = 0; kr < s.kernel_h; ++kr) {
+                                const float w = kernel[(c * s.kernel_w + kc) * s.kernel_h + kr];
+                                for (uint32_t oc = 0; oc < s.out_cols; ++oc) {
+                                    const float *in_col = in + c * plane + (oc * s.stride_w + kc) * s.rows + kr;
+                                    float *out_col = out_k + oc * s.out_rows;
+                                    for (uint32_t orow = 0; orow < s.out_rows; ++orow) {
+                                        out_col[orow] += w * in_col[orow * s.stride_h];
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        void conv_tiled(const float *in, const std::vector<ftensor> &kernels, const ConvShape &s,
+                          float *out, uint32_t tile, uint32_t threads) {
+            const uint32_t plane = s.rows * s.cols;
+            const uint32_t out_plane = s.out_rows * s.out_cols;
+            parallel_for(0, s.kernels, threads, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t k = begin; k < end; ++k) {
+                    const float *kernel = kernels.at(k).data().memptr();
+                    float *out_k = out + k * out_plane;
+                    for (uint32_t oc0 = 0; oc0 < s.out_cols; oc0 += tile) {
+                        const uint32_t oc1 = std::min(oc0 + tile, s.out_cols);
+                        for (uint32_t or0 = 0; or0 < s.out_rows; or0 += tile) {
+                            const uint32_t or1 = std::min(or0 + tile, s.out_rows);
+                            // the output tile stays in cache while all channels are accumulated into it
+                            for (uint32_t c = 0; c < s.channels; ++c) {
+                                for (uint32_t kc = 0; kc < s.kernel_w; ++kc) {
+                                    for (uint32_t kr = 0; kr < s.kernel_h; ++kr) {
+                                        const float w = kernel[(c * s.kernel_w + kc) * s.kernel_h + kr];
+                                        for (uint32_t oc = oc0; oc < oc1; ++oc) {
+                                            const float *in_col =
+                                                    in + c * plane + (oc * s.stride_w + kc) * s.rows + kr;
+                                            float *out_col = out_k + oc * s.out_rows;
+                                            for (uint32_t orow = or0; orow < or1; ++orow) {
+                                                out_col[orow] += w * in_col[orow * s.stride_h];
+                                            }
+                                        }
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        ftensor pad_input(const ftensor &input, const ConvParams &params) {
+            ftensor padded = input;
+            if (params.pad_h > 0 || params.pad_w > 0) {
+                padded.padding({params.pad_h, params.pad_h, params.pad_w, params.pad_w}, 0.f);
+            }
+            return padded;
+        }
+
+        ConvShape make_shape(const ftensor &padded, uint32_t kernels, uint32_t kernel_h, uint32_t kernel_w,
+                             const ConvParams &params) {
+            CHECK(params.stride_h > 0 && params.stride_w > 0) << "stride must be positive";
+            CHECK_GE(padded.rows(), kernel_h) << "kernel is larger than the input";
+            CHECK_GE(padded.cols(), kernel_w) << "kernel is larger than the input";
+            ConvShape s{};
+            s.channels = padded.channels();
+            s.rows = padded.rows();
+            s.cols = padded.cols();
+            s.kernels = kernels;
+            s.kernel_h = kernel_h;
+            s.kernel_w = kernel_w;
+            s.stride_h = params.stride_h;
+            s.stride_w = params.stride_w;
+            s.out_rows = (s.rows - s.kernel_h) / s.stride_h + 1;
+            s.out_cols = (s.cols - s.kernel_w) / s.stride_w + 1;
+            return s;
+        }
+
+        // row (oc * out_rows + orow) holds the window of that output pixel, so that
+        // input_cols * kernel_mat has exactly the memory layout of the output cube
+        arma::fmat unfold(const float *in, const ConvShape &s, uint32_t threads) {
+            const uint32_t plane = s.rows * s.cols;
+            const uint32_t kernel_size = s.channels * s.kernel_h * s.kernel_w;
+            arma::fmat input_cols(s.out_rows * s.out_cols, kernel_size);
+            parallel_for(0, kernel_size, threads, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; ++i) {
+                    const uint32_t c = i / (s.kernel_h * s.kernel_w);
+                    const uint32_t kc = (i / s.kernel_h) % s.kernel_w;
+                    const uint32_t kr = i % s.kernel_h;
+                    float *col = input_cols.colptr(i);
+                    for (uint32_t oc = 0; oc < s.out_cols; ++oc) {
+                        const float *in_col = in + c * plane + (oc * s.stride_w + kc) * s.rows + kr;
+                        for (uint32_t orow = 0; orow < s.out_rows; ++orow) {
+                            *col++ = in_col[orow * s.stride_h];
+                        }
+                    }
+                }
+            });
+            return input_cols;
+        }
+
+        void conv_im2col(const float *in, const std::vector<ftensor> &kernels, const ConvShape &s,
+                         float *out, uint32_t threads) {
+            const uint32_t kernel_size = s.channels * s.kernel_h * s.kernel_w;
+            const uint32_t out_plane = s.out_rows * s.out_cols;
+            const arma::fmat input_cols = unfold(in, s, threads);
+            const TrackedBytes cols_bytes(input_cols.n_elem * sizeof(float));
+
+            arma::fmat kernel_mat(kernel_size, s.kernels);
+            const TrackedBytes kernel_bytes(kernel_mat.n_elem * sizeof(float));
+            for (uint32_t k = 0; k < s.kernels; ++k) {
+                const float *kernel = kernels.at(k).data().memptr();
+                std::copy(kernel, kernel + kernel_size, kernel_mat.colptr(k));
+            }
+
+            parallel_for(0, s.kernels, threads, [&](uint32_t begin, uint32_t end) {
+                const arma::fmat kernel_part(kernel_mat.colptr(begin), kernel_size, end - begin, false, true);
+                arma::fmat out_part(out + begin * out_plane, out_plane, end - begin, false, true);
+                out_part = input_cols * kernel_part;
+            });
+        }
+
+        // F(2x2, 3x3): Y = A^T [sum_c (G g G^T) . (B^T d B)] A
+        void winograd_kernel(const float *g, float *u) {
+            // g is column major 3x3, u is row major 4x4
+            float gg[4][3];
+            for (uint32_t j = 0; j < 3; ++j) {
+                const float g0 = g[j * 3], g1 = g[j * 3 + 1], g2 = g[j * 3 + 2];
+                gg[0][j] = g0;
+                gg[1][j] = (g0 + g1 + g2) * 0.5f;
+                gg[2][j] = (g0 - g1 + g2) * 0.5f;
+                gg[3][j] = g2;
+            }
+            for (uint32_t i = 0; i < 4; ++i) {
+                u[i * 4] = gg[i][0];
+                u[i * 4 + 1] = (gg[i][0] + gg[i][1] + gg[i][2]) * 0.5f;
+                u[i * 4 + 2] = (gg[i][0] - gg[i][1] + gg[i][2]) * 0.5f;
+                u[i * 4 + 3] = gg[i][2];
+            }
+        }
+
+        void winograd_input(const float d[4][4], float *v) {
+            float t[4][4];
+            for (uint32_t j = 0; j < 4; ++j) {
+                t[0][j] = d[0][j] - d[2][j];
+                t[1][j] = d[1][j] + d[2][j];
+                t[2][j] = d[2][j] - d[1][j];
+                t[3][j] = d[1][j] - d[3][j];
+            }
+            for (uint32_t i = 0; i < 4; ++i) {
+                v[i * 4] = t[i][0] - t[i][2];
+                v[i * 4 + 1] = t[i][1] + t[i][2];
+                v[i * 4 + 2] = t[i][2] - t[i][1];
+                v[i * 4 + 3] = t[i][1] - t[i][3];
+            }
+        }
+
+        void conv_winograd(const float *in, const std::vector<ftensor> &kernels, const ConvShape &s,
+                           float *out, uint32_t threads) {
+            const uint32_t plane = s.rows * s.cols;
+            const uint32_t out_plane = s.out_rows * s.out_cols;
+            const uint32_t tiles_h = (s.out_rows + 1) / 2;
+            const uint32_t tiles_w = (s.out_cols + 1) / 2;
+
+            std::vector<float> u(s.kernels * s.channels * 16);
+            const TrackedBytes u_bytes(u.size() * sizeof(float));
+            for (uint32_t k = 0; k < s.kernels; ++k) {
+                const float *kernel = kernels.at(k).data().memptr();
+                for (uint32_t c = 0; c < s.channels; ++c) {
+                    winograd_kernel(kernel + c * 9, u.data() + (k * s.channels + c) * 16);
+                }
+            }
+
+            parallel_for(0, tiles_w, threads, [&](uint32_t begin, uint32_t end) {
+                std::vector<float> v(s.channels * 16);
+                float d[4][4];
+                float m[16];
+                for (uint32_t tx = begin; tx < end; ++tx) {
+                    for (uint32_t ty = 0; ty < tiles_h; ++ty) {
+                        for (uint32_t c = 0; c < s.channels; ++c) {
+                            const float *in_c = in + c * plane;
+                            for (uint32_t i = 0; i < 4; ++i) {
+                                for (uint32_t j = 0; j < 4; ++j) {
+                                    const uint32_t r = ty * 2 + i, col = tx * 2 + j;
+                                    d[i][j] = (r < s.rows && col < s.cols) ? in_c[col * s.rows + r] : 0.f;
+                                }
+                            }
+                            winograd_input(d, v.data() + c * 16);
+                        }
+
+                        for (uint32_t k = 0; k < s.kernels; ++k) {
+                            std::fill(m, m + 16, 0.f);
+                            const float *u_k = u.data() + k * s.channels * 16;
+                            for (uint32_t c = 0; c < s.channels; ++c) {
+                                for (uint32_t e = 0; e < 16; ++e) {
+                                    m[e] += u_k[c * 16 + e] * v[c * 16 + e];
+                                }
+                            }
+                            float a[2][4];
+                            for (uint32_t j = 0; j < 4; ++j) {
+                                a[0][j] = m[j] + m[4 + j] + m[8 + j];
+                                a[1][j] = m[4 + j] - m[8 + j] - m[12 + j];
+                            }
+                            float *out_k = out + k * out_plane;
+                            for (uint32_t i = 0; i < 2; ++i) {
+                                const uint32_t orow = ty * 2 + i;
+                                if (orow >= s.out_rows) {
+                                    continue;
+                                }
+                                out_k[tx * 2 * s.out_rows + orow] = a[i][0] + a[i][1] + a[i][2];
+                                if (tx * 2 + 1 < s.out_cols) {
+                                    out_k[(tx * 2 + 1) * s.out_rows + orow] = a[i][1] - a[i][2] - a[i][3];
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        std::string shape_key(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params) {
+            const ftensor &kernel = kernels.front();
+            return std::to_string(input.channels()) + "x" + std::to_string(input.rows()) + "x" +
+                   std::to_string(input.cols()) + "_k" + std::to_string(kernels.size()) + "x" +
+                   std::to_string(kernel.rows()) + "x" + std::to_string(kernel.cols()) + "_s" +
+                   std::to_string(params.stride_h) + "x" + std::to_string(params.stride_w) + "_p" +
+                   std::to_string(params.pad_h) + "x" + std::to_string(params.pad_w);
+        }
+    }
+
+    std::string to_string(const ConvConfig &config) {
+        std::string name;
+        switch (config.algorithm) {
+            case ConvAlgorithm::kDirect:
+                name = "direct";
+                break;
+            case ConvAlgorithm::kTiled:
+                name = "tiled/tile" + std::to_string(config.tile);
+                break;
+            case ConvAlgorithm::kIm2col:
+                name = "im2col";
+                break;
+            case ConvAlgorithm::kWinograd:
+                name = "winograd";
+                break;
+        }
+        return name + "/threads" + std::to_string(config.threads);
+    }
+
+    bool conv2d_supported(ConvAlgorithm algorithm, uint32_t kernel_h, uint32_t kernel_w, const ConvParams &params) {
+        if (algorithm == ConvAlgorithm::kWinograd) {
+            return kernel_h == 3 && kernel_w == 3 && params.stride_h == 1 && params.stride_w == 1;
+        }
+        return true;
+    }
+
+    ftensor conv2d(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params,
+                   const ConvConfig &config) {
+        MemoryScope scope("conv2d");
+        CHECK(!input.empty()) << "input is empty";
+        CHECK(!kernels.empty()) << "kernels are empty";
+        CHECK_GT(config.threads, 0);
+        const ftensor &first = kernels.front();
+        for (const auto &kernel: kernels) {
+            CHECK(kernel.shapes() == first.shapes()) << "kernels have different shapes";
+        }
+        CHECK_EQ(first.channels(), input.channels()) << "kernel channels is not equal to input channels";
+        CHECK(conv2d_supported(config.algorithm, first.rows(), first.cols(), params))
+                        << to_string(config) << " does not support this convolution";
+
+        const ftensor padded = pad_input(input, params);
+        const ConvShape s = make_shape(padded, kernels.size(), first.rows(), first.cols(), params);
+
+        ftensor output(s.kernels, s.out_rows, s.out_cols);
+        output.zeros();
+        const float *in = padded.data().memptr();
+        float *out = output.data().memptr();
+        switch (config.algorithm) {
+            case ConvAlgorithm::kDirect:
+                conv_direct(in, kernels, s, out, config.threads);
+                break;
+            case ConvAlgorithm::kTiled:
+                CHECK_GT(config.tile, 0);
+                conv_tiled(in, kernels, s, out, config.tile, config.threads);
+                break;
+            case ConvAlgorithm::kIm2col:
+                conv_im2col(in, kernels, s, out, config.threads);
+                break;
+            case ConvAlgorithm::kWinograd:
+                conv_winograd(in, kernels, s, out, config.threads);
+                break;
+        }
+        return output;
+    }
+
+    std::vector<uint32_t> conv2d_output_shape(const ftensor &input, uint32_t kernel_h, uint32_t kernel_w,
+                                              const ConvParams &params) {
+        CHECK(!input.empty()) << "input is empty";
+        CHECK(params.stride_h > 0 && params.stride_w > 0) << "stride must be positive";
+        const uint32_t rows = input.rows() + 2 * params.pad_h;
+        const uint32_t cols = input.cols() + 2 * params.pad_w;
+        CHECK(rows >= kernel_h && cols >= kernel_w) << "kernel is larger than the input";
+        return {(rows - kernel_h) / params.stride_h + 1, (cols - kernel_w) / params.stride_w + 1};
+    }
+
+    arma::fmat im2col(const ftensor &input, uint32_t kernel_h, uint32_t kernel_w, const ConvParams &params,
+                      uint32_t threads) {
+        CHECK(!input.empty()) << "input is empty";
+        CHECK_GT(threads, 0);
+        const ftensor padded = pad_input(input, params);
+        const ConvShape s = make_shape(padded, 1, kernel_h, kernel_w, params);
+        return unfold(padded.data().memptr(), s, threads);
+    }
+
+    std::vector<ConvConfig> conv2d_candidates(uint32_t kernel_h, uint32_t kernel_w, const ConvParams &params) {
+        const uint32_t hardware = hardware_threads();
+        const std::set<uint32_t> thread_counts{1, std::max(1u, hardware / 2), hardware};
+
+        std::vector<ConvConfig> candidates;
+        for (uint32_t threads: thread_counts) {
+            candidates.push_back({ConvAlgorithm::kIm2col, 0, threads});
+            candidates.push_back({ConvAlgorithm::kDirect, 0, threads});
+            for (uint32_t tile: {8, 16, 32}) {
+                candidates.push_back({ConvAlgorithm::kTiled, tile, threads});
+            }
+            if (conv2d_supported(ConvAlgorithm::kWinograd, kernel_h, kernel_w, params)) {
+                candidates.push_back({ConvAlgorithm::kWinograd, 0, threads});
+            }
+        }
+        return candidates;
+    }
+
+    ftensor conv2d(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params) {
+        return conv2d(input, kernels, params, Autotuner::global());
+    }
+
+    ftensor conv2d(const ftensor &input, const std::vector<ftensor> &kernels, const ConvParams &params,
+                   Autotuner &tuner) {
+        CHECK(!kernels.empty()) << "kernels are empty";
+        const std::vector<ConvConfig> configs = conv2d_candidates(kernels.front().rows(), kernels.front().cols(),
+                                                                  params);
+        std::vector<Autotuner::Candidate> candidates;
+        size_t fallback = 0;
+        for (const auto &config: configs) {
+            // without tuning, im2col on all threads is the safest default
+            if (config.algorithm == ConvAlgorithm::kIm2col && config.threads == hardware_threads()) {
+                fallback = candidates.size();
+            }
+            candidates.push_back({to_string(config), [&input, &kernels, &params, config]() {
+                conv2d(input, kernels, params, config);
+            }});
+        }
+        const size_t best = tuner.select("conv2d", shape_key(input, kernels, params), candidates, fallback);
+        return conv2d(input, kernels, params, configs.at(best));
+    }
+}
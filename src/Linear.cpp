@@ -0,0 +1,226 @@
+/**
+  *******************************************************
+  * @file           : Linear.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/21
+  *******************************************************
+  */
+
+#include <Linear.h>
+#include <glog/logging.h>
+
+#if defined(__AVX__) && defined(__FMA__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace wonton {
+    namespace {
+        // 8 float lanes, one per output feature of a panel
+#if defined(__AVX__) && defined(__FMA__)
+        struct Lanes {
+            __m256 v;
+        };
+
+        inline Lanes lanes_zero() { return {_mm256_setzero_ps()}; }
+        inline Lanes lanes_load(const float *p) { return {_mm256_loadu_ps(p)}; }
+        inline Lanes lanes_fma(Lanes acc, Lanes w, float x) { return {_mm256_fmadd_ps(w.v, _mm256_set1_ps(x), acc.v)}; }
+        inline Lanes lanes_add(Lanes a, Lanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+        inline void lanes_store(float *p, Lanes a) { _mm256_storeu_ps(p, a.v); }
+#elif defined(__SSE2__)
+        struct Lanes {
+            __m128 lo, hi;
+        };
+
+        inline Lanes lanes_zero() { return {_mm_setzero_ps(), _mm_setzero_ps()}; }
+        inline Lanes lanes_load(const float *p) { return {_mm_loadu_ps(p), _mm_loadu_ps(p + 4)}; }
+        inline Lanes lanes_fma(Lanes acc, Lanes w, float x) {
+            const __m128 s = _mm_set1_ps(x);
+            return {_mm_add_ps(acc.lo, _mm_mul_ps(w.lo, s)), _mm_add_ps(acc.hi, _mm_mul_ps(w.hi, s))};
+        }
+        inline Lanes lanes_add(Lanes a, Lanes b) { return {_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)}; }
+        inline void lanes_store(float *p, Lanes a) {
+            _mm_storeu_ps(p, a.lo);
+            _mm_storeu_ps(p + 4, a.hi);
+        }
+#else
+        struct Lanes {
+            float v[8];
+        };
+
+        inline Lanes lanes_zero() { return {}; }
+        inline Lanes lanes_load(const float *p) {
+            Lanes a;
+            std::copy(p, p + 8, a.v);
+            return a;
+        }
+        inline Lanes lanes_fma(Lanes acc, Lanes w, float x) {
+            for (uint32_t r = 0; r < 8; ++r) {
+                acc.v[r] += w.v[r] * x;
+            }
+            return acc;
+        }
+        inline Lanes lanes_add(Lanes a, Lanes b) {
+            for (uint32_t r = 0; r < 8; ++r) {
+                a.v[r] += b.v[r];
+            }
+            return a;
+        }
+        inline void lanes_store(float *p, Lanes a) { std::copy(a.v, a.v + 8, p); }
+#endif
+        static_assert(Linear::kPanel == 8, "Lanes hold one panel");
+
+        // keeps a panel of the output for NB samples in registers, the panel is streamed once
+        template<uint32_t NB>
+        void gemm_kernel(const float *panel, const float *x, uint32_t batch, uint32_t in, Lanes *acc) {
+            for (uint32_t b = 0; b < NB; ++b) {
+                acc[b] = lanes_zero();
+            }
+            for (uint32_t k = 0; k < in; ++k) {
+                const Lanes w = lanes_load(panel + k * Linear::kPanel);
+                const float *xk = x + k * batch;
+                for (uint32_t b = 0; b < NB; ++b) {
+                    acc[b] = lanes_fma(acc[b], w, xk[b]);
+                }
+            }
+        }
+
+        // scatter one panel of one sample into the column major [batch, out] output
+        void store_panel(Lanes acc, const float *bias, uint32_t first, uint32_t out, uint32_t batch,
+                         uint32_t sample, float *output) {
+            float values[Linear::kPanel];
+            lanes_store(values, lanes_add(acc, lanes_load(bias + first)));
+            const uint32_t count = std::min(Linear::kPanel, out - first);
+            for (uint32_t r = 0; r < count; ++r) {
+                output[(first + r) * batch + sample] = values[r];
+            }
+        }
+    }
+
+    Linear::Linear(const ftensor &weights, const ftensor &bias, uint32_t threads) {
+        CHECK(!weights.empty()) << "weights are empty";
+        CHECK_EQ(weights.channels(), 1) << "weights must be [out_features, in_features]";
+        this->out_features_ = weights.rows();
+        this->in_features_ = weights.cols();
+        this->panels_ = (this->out_features_ + kPanel - 1) / kPanel;
+        this->set_threads(threads);
+
+        const arma::fmat &w = weights.slice(0);
+        this->packed_.assign(static_cast<size_t>(this->panels_) * this->in_features_ * kPanel, 0.f);
+        this->packed_bytes_ = TrackedBytes(this->packed_.size() * sizeof(float));
+        for (uint32_t p = 0; p < this->panels_; ++p) {
+            for (uint32_t k = 0; k < this->in_features_; ++k) {
+                float *dst = this->packed_.data() + (static_cast<size_t>(p) * this->in_features_ + k) * kPanel;
+                for (uint32_t r = 0; r < kPanel && p * kPanel + r < this->out_features_; ++r) {
+                    dst[r] = w.at(p * kPanel + r, k);
+                }
+            }
+        }
+
+        this->bias_.assign(this->panels_ * kPanel, 0.f);
+        if (!bias.empty()) {
+            CHECK_EQ(bias.size(), this->out_features_) << "bias size is not equal to out_features";
+            const arma::fcube &b = bias.data();
+            std::copy(b.begin(), b.end(), this->bias_.begin());
+        }
+    }
+
+    uint32_t Linear::in_features() const {
+        return this->in_features_;
+    }
+
+    uint32_t Linear::out_features() const {
+        return this->out_features_;
+    }
+
+    void Linear::set_gemv_max_batch(uint32_t batch) {
+        this->gemv_max_batch_ = batch;
+    }
+
+    void Linear::set_threads(uint32_t threads) {
+        CHECK_GT(threads, 0);
+        this->threads_ = threads;
+    }
+
+    uint32_t Linear::threads_for(uint32_t batch) const {
+        // starting a thread costs about as much as a few 10k multiply-adds
+        constexpr uint64_t kMinWorkPerThread = 1u << 16;
+        const uint64_t work = uint64_t(batch) * this->in_features_ * this->out_features_;
+        const auto useful = static_cast<uint32_t>(std::max<uint64_t>(1, work / kMinWorkPerThread));
+        return std::min({this->threads_, useful, this->panels_});
+    }
+
+    ftensor Linear::forward(const ftensor &input) const {
+        MemoryScope scope("Linear::forward");
+        CHECK(!input.empty()) << "input is empty";
+        CHECK_EQ(input.channels(), 1) << "input must be [batch, in_features] or [in_features]";
+        CHECK_EQ(input.cols(), this->in_features_) << "input features is not equal to in_features";
+        const uint32_t batch = input.rows();
+
+        ftensor output(batch, this->out_features_);
+        const float *x = input.data().memptr();
+        float *y = output.data().memptr();
+        if (batch <= this->gemv_max_batch_) {
+            this->gemv(x, batch, y);
+        } else {
+            this->gemm(x, batch, y);
+        }
+        return output;
+    }
+
+    void Linear::gemv(const float *input, uint32_t batch, float *output) const {
+        const uint32_t in = this->in_features_;
+        parallel_for(0, this->panels_, this->threads_for(batch), [&](uint32_t begin, uint32_t end) {
+            for (uint32_t p = begin; p < end; ++p) {
+                const float *panel = this->packed_.data() + static_cast<size_t>(p) * in * kPanel;
+                for (uint32_t s = 0; s < batch; ++s) {
+                    // a single sample is bound by the weight bandwidth, two chains hide the fma latency
+                    Lanes acc0 = lanes_zero(), acc1 = lanes_zero();
+                    uint32_t k = 0;
+                    for (; k + 1 < in; k += 2) {
+                        acc0 = lanes_fma(acc0, lanes_load(panel + k * kPanel), input[k * batch + s]);
+                        acc1 = lanes_fma(acc1, lanes_load(panel + (k + 1) * kPanel), input[(k + 1) * batch + s]);
+                    }
+                    if (k < in) {
+                        acc0 = lanes_fma(acc0, lanes_load(panel + k * kPanel), input[k * batch + s]);
+                    }
+                    store_panel(lanes_add(acc0, acc1), this->bias_.data(), p * kPanel, this->out_features_,
+                                batch, s, output);
+                }
+            }
+        });
+    }
+
+    void Linear::gemm(const float *input, uint32_t batch, float *output) const {
+        const uint32_t in = this->in_features_;
+        parallel_for(0, this->panels_, this->threads_for(batch), [&](uint32_t begin, uint32_t end) {
+            Lanes acc[kBlock];
+            for (uint32_t p = begin; p < end; ++p) {
+                const float *panel = this->packed_.data() + static_cast<size_t>(p) * in * kPanel;
+                for (uint32_t s = 0; s < batch; s += kBlock) {
+                    const uint32_t count = std::min(kBlock, batch - s);
+                    switch (count) {
+                        case 4:
+                            gemm_kernel<4>(panel, input + s, batch, in, acc);
+                            break;
+                        case 3:
+                            gemm_kernel<3>(panel, input + s, batch, in, acc);
+                            break;
+                        case 2:
+                            gemm_kernel<2>(panel, input + s, batch, in, acc);
+                            break;
+                        default:
+                            gemm_kernel<1>(panel, input + s, batch, in, acc);
+                            break;
+                    }
+                    for (uint32_t b = 0; b < count; ++b) {
+                        store_panel(acc[b], this->bias_.data(), p * kPanel, this->out_features_, batch, s + b,
+                                    output);
+                    }
+                }
+            }
+        });
+    }
+}
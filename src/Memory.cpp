@@ -0,0 +1,192 @@
+/**
+  *******************************************************
+  * @file           : Memory.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/22
+  *******************************************************
+  */
+
+#include <Memory.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+
+namespace wonton {
+    namespace {
+        std::atomic<uint64_t> live_bytes{0};
+        std::atomic<uint64_t> peak_bytes{0};
+        std::atomic<uint64_t> allocations{0};
+        std::atomic<uint64_t> allocated_bytes{0};
+        std::atomic<uint64_t> largest_transient{0};
+
+        std::atomic<bool> scopes_on{[] {
+            const char *enabled = std::getenv("WONTON_MEMORY_SCOPES");
+            return enabled != nullptr && std::string(enabled) == "1";
+        }()};
+        std::mutex scope_mutex;
+        std::map<std::string, ScopeMemoryStats> scopes;
+
+        thread_local MemoryScope *current_scope = nullptr;
+
+        // the outermost scope of this thread, kept with the scopes disabled for the global largest_transient
+        struct OuterCall {
+            uint32_t depth = 0;
+            int64_t live = 0;       // growth of the live bytes since the call started
+            int64_t peak = 0;
+        };
+        thread_local OuterCall outer_call;
+
+        void update_max(std::atomic<uint64_t> &target, uint64_t value) {
+            uint64_t current = target.load();
+            while (value > current && !target.compare_exchange_weak(current, value)) {
+            }
+        }
+    }
+
+    void MemoryTracker::allocate(uint64_t bytes) {
+        if (bytes == 0) {
+            return;
+        }
+        update_max(peak_bytes, live_bytes.fetch_add(bytes) + bytes);
+        allocations += 1;
+        allocated_bytes += bytes;
+        if (outer_call.depth > 0) {
+            outer_call.live += static_cast<int64_t>(bytes);
+            outer_call.peak = std::max(outer_call.peak, outer_call.live);
+        }
+        for (MemoryScope *scope = current_scope; scope != nullptr; scope = scope->parent_) {
+            scope->live_ += static_cast<int64_t>(bytes);
+            scope->peak_ = std::max(scope->peak_, static_cast<uint64_t>(std::max<int64_t>(scope->live_, 0)));
+            scope->allocations_ += 1;
+            scope->allocated_bytes_ += bytes;
+        }
+    }
+
+    void MemoryTracker::release(uint64_t bytes) {
+        if (bytes == 0) {
+            return;
+        }
+        live_bytes -= bytes;
+        if (outer_call.depth > 0) {
+            outer_call.live -= static_cast<int64_t>(bytes);
+        }
+        for (MemoryScope *scope = current_scope; scope != nullptr; scope = scope->parent_) {
+            scope->live_ -= static_cast<int64_t>(bytes);
+        }
+    }
+
+    MemoryStats MemoryTracker::stats() {
+        MemoryStats stats;
+        stats.live_bytes = live_bytes.load();
+        stats.peak_bytes = peak_bytes.load();
+        stats.allocations = allocations.load();
+        stats.allocated_bytes = allocated_bytes.load();
+        stats.largest_transient = largest_transient.load();
+        return stats;
+    }
+
+    std::map<std::string, ScopeMemoryStats> MemoryTracker::scope_stats() {
+        std::lock_guard<std::mutex> lock(scope_mutex);
+        return scopes;
+    }
+
+    void MemoryTracker::set_scopes_enabled(bool enabled) {
+        scopes_on = enabled;
+    }
+
+    bool MemoryTracker::scopes_enabled() {
+        return scopes_on.load(std::memory_order_relaxed);
+    }
+
+    void MemoryTracker::reset_peak() {
+        peak_bytes = live_bytes.load();
+    }
+
+    void MemoryTracker::reset() {
+        reset_peak();
+        allocations = 0;
+        allocated_bytes = 0;
+        largest_transient = 0;
+        std::lock_guard<std::mutex> lock(scope_mutex);
+        scopes.clear();
+    }
+
+    void MemoryTracker::dump(std::ostream &stream) {
+        const MemoryStats global = stats();
+        stream << "memory: live " << global.live_bytes << " B, peak " << global.peak_bytes
+               << " B, allocations " << global.allocations << " (" << global.allocated_bytes
+               << " B), largest transient " << global.largest_transient << " B\n";
+        stream << std::left << std::setw(32) << "scope" << std::right << std::setw(10) << "calls"
+               << std::setw(14) << "allocations" << std::setw(16) << "allocated B" << std::setw(16) << "peak B"
+               << std::setw(16) << "transient B" << std::setw(16) << "retained B" << "\n";
+        for (const auto &[name, scope]: scope_stats()) {
+            stream << std::left << std::setw(32) << name << std::right << std::setw(10) << scope.calls
+                   << std::setw(14) << scope.allocations << std::setw(16) << scope.allocated_bytes
+                   << std::setw(16) << scope.peak_bytes << std::setw(16) << scope.largest_transient
+                   << std::setw(16) << scope.retained_bytes << "\n";
+        }
+    }
+
+    void MemoryTracker::report() {
+        std::ostringstream stream;
+        dump(stream);
+        LOG(INFO) << "\n" << stream.str();
+    }
+
+    MemoryScope::MemoryScope(const char *name)
+            : name_(name), active_(MemoryTracker::scopes_enabled()), parent_(current_scope) {
+        if (outer_call.depth++ == 0) {
+            outer_call.live = 0;
+            outer_call.peak = 0;
+        }
+        if (this->active_) {
+            current_scope = this;
+        }
+    }
+
+    MemoryScope::~MemoryScope() {
+        if (--outer_call.depth == 0) {
+            const int64_t kept = std::max<int64_t>(outer_call.live, 0);
+            update_max(largest_transient, static_cast<uint64_t>(std::max<int64_t>(outer_call.peak - kept, 0)));
+        }
+        if (!this->active_) {
+            return;
+        }
+        current_scope = this->parent_;
+        const uint64_t kept = static_cast<uint64_t>(std::max<int64_t>(this->live_, 0));
+        const uint64_t transient = this->peak_ - std::min(this->peak_, kept);
+
+        std::lock_guard<std::mutex> lock(scope_mutex);
+        ScopeMemoryStats &stats = scopes[this->name_];
+        stats.calls += 1;
+        stats.allocations += this->allocations_;
+        stats.allocated_bytes += this->allocated_bytes_;
+        stats.peak_bytes = std::max(stats.peak_bytes, this->peak_);
+        stats.largest_transient = std::max(stats.largest_transient, transient);
+        stats.retained_bytes += this->live_;
+    }
+
+    TrackedBytes::TrackedBytes(uint64_t bytes) : bytes_(bytes) {
+        MemoryTracker::allocate(this->bytes_);
+    }
+
+    TrackedBytes::TrackedBytes(const TrackedBytes &other) : TrackedBytes(other.bytes_) {}
+
+    TrackedBytes::TrackedBytes(TrackedBytes &&other) noexcept: bytes_(other.bytes_) {
+        other.bytes_ = 0;
+    }
+
+    TrackedBytes &TrackedBytes::operator=(TrackedBytes other) noexcept {
+        std::swap(this->bytes_, other.bytes_);
+        return *this;
+    }
+
+    TrackedBytes::~TrackedBytes() {
+        MemoryTracker::release(this->bytes_);
+    }
+}
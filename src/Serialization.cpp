@@ -0,0 +1,371 @@
+/**
+  *******************************************************
+  * @file           : Serialization.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/18
+  *******************************************************
+  */
+
+#include <Serialization.h>
+#include <Memory.h>
+#include <glog/logging.h>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <unistd.h>
+
+#ifdef WONTON_WITH_ZSTD
+#include <zstd.h>
+#endif
+#ifdef WONTON_WITH_LZ4
+#include <lz4.h>
+#endif
+
+namespace wonton {
+    namespace {
+        static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "the tensor format is little endian");
+
+        constexpr char kMagic[4] = {'W', 'T', 'N', 'S'};
+        constexpr uint8_t kVersion = 1;
+        constexpr uint8_t kDtypeFloat32 = 0;
+        constexpr uint8_t kLayoutColMajor = 0;
+        constexpr size_t kHeaderBytes = 40;
+
+        struct Header {
+            uint8_t version = kVersion;
+            uint8_t dtype = kDtypeFloat32;
+            uint8_t layout = kLayoutColMajor;
+            Compression compression = Compression::kNone;
+            uint8_t rank = 0;
+            uint32_t raw_shape[3] = {0, 0, 0};
+            uint32_t rows = 0;
+            uint32_t cols = 0;
+            uint32_t channels = 0;
+            uint32_t chunk_bytes = 0;
+        };
+
+        void put_u32(char *buffer, uint32_t value) {
+            std::memcpy(buffer, &value, sizeof(value));
+        }
+
+        uint32_t get_u32(const char *buffer) {
+            uint32_t value;
+            std::memcpy(&value, buffer, sizeof(value));
+            return value;
+        }
+
+        class Sink {
+        public:
+            virtual ~Sink() = default;
+            virtual void write(const char *data, size_t bytes) = 0;
+        };
+
+        class Source {
+        public:
+            virtual ~Source() = default;
+            virtual void read(char *data, size_t bytes) = 0;
+        };
+
+        class StreamSink : public Sink {
+        public:
+            explicit StreamSink(std::ostream &stream) : stream_(stream) {}
+            void write(const char *data, size_t bytes) override {
+                this->stream_.write(data, static_cast<std::streamsize>(bytes));
+                CHECK(this->stream_.good()) << "failed to write tensor";
+            }
+        private:
+            std::ostream &stream_;
+        };
+
+        class StreamSource : public Source {
+        public:
+            explicit StreamSource(std::istream &stream) : stream_(stream) {}
+            void read(char *data, size_t bytes) override {
+                this->stream_.read(data, static_cast<std::streamsize>(bytes));
+                CHECK(this->stream_.good()) << "failed to read tensor, unexpected end of stream";
+            }
+        private:
+            std::istream &stream_;
+        };
+
+        class FdSink : public Sink {
+        public:
+            explicit FdSink(int fd) : fd_(fd) {}
+            void write(const char *data, size_t bytes) override {
+                while (bytes > 0) {
+                    const ssize_t written = ::write(this->fd_, data, bytes);
+                    if (written < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    CHECK_GT(written, 0) << "failed to write tensor: " << std::strerror(errno);
+                    data += written;
+                    bytes -= static_cast<size_t>(written);
+                }
+            }
+        private:
+            int fd_;
+        };
+
+        class FdSource : public Source {
+        public:
+            explicit FdSource(int fd) : fd_(fd) {}
+            void read(char *data, size_t bytes) override {
+                while (bytes > 0) {
+                    const ssize_t count = ::read(this->fd_, data, bytes);
+                    if (count < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    CHECK_GE(count, 0) << "failed to read tensor: " << std::strerror(errno);
+                    CHECK_GT(count, 0) << "failed to read tensor, unexpected end of file";
+                    data += count;
+                    bytes -= static_cast<size_t>(count);
+                }
+            }
+        private:
+            int fd_;
+        };
+
+        size_t compress_bound(Compression compression, size_t bytes) {
+            switch (compression) {
+#ifdef WONTON_WITH_ZSTD
+                case Compression::kZstd:
+                    return ZSTD_compressBound(bytes);
+#endif
+#ifdef WONTON_WITH_LZ4
+                case Compression::kLz4:
+                    return static_cast<size_t>(LZ4_compressBound(static_cast<int>(bytes)));
+#endif
+                default:
+                    return bytes;
+            }
+        }
+
+        // return the compressed size, or 0 if the chunk should be stored as is
+        size_t compress(Compression compression, [[maybe_unused]] int level, [[maybe_unused]] const char *src,
+                        size_t bytes, [[maybe_unused]] char *dst, [[maybe_unused]] size_t capacity) {
+            size_t stored = 0;
+            switch (compression) {
+#ifdef WONTON_WITH_ZSTD
+                case Compression::kZstd: {
+                    const size_t result = ZSTD_compress(dst, capacity, src, bytes, level);
+                    stored = ZSTD_isError(result) ? 0 : result;
+                    break;
+                }
+#endif
+#ifdef WONTON_WITH_LZ4
+                case Compression::kLz4: {
+                    const int result = LZ4_compress_default(src, dst, static_cast<int>(bytes),
+                                                            static_cast<int>(capacity));
+                    stored = result > 0 ? static_cast<size_t>(result) : 0;
+                    break;
+                }
+#endif
+                default:
+                    break;
+            }
+            return stored < bytes ? stored : 0;
+        }
+
+        void decompress(Compression compression, [[maybe_unused]] const char *src, [[maybe_unused]] size_t stored,
+                        [[maybe_unused]] char *dst, [[maybe_unused]] size_t bytes) {
+            switch (compression) {
+#ifdef WONTON_WITH_ZSTD
+                case Compression::kZstd: {
+                    const size_t result = ZSTD_decompress(dst, bytes, src, stored);
+                    CHECK(!ZSTD_isError(result) && result == bytes) << "corrupted zstd chunk";
+                    return;
+                }
+#endif
+#ifdef WONTON_WITH_LZ4
+                case Compression::kLz4: {
+                    const int result = LZ4_decompress_safe(src, dst, static_cast<int>(stored),
+                                                           static_cast<int>(bytes));
+                    CHECK_EQ(result, static_cast<int>(bytes)) << "corrupted lz4 chunk";
+                    return;
+                }
+#endif
+                default:
+                    LOG(FATAL) << "compression " << static_cast<int>(compression) << " is not available";
+            }
+        }
+
+        void save(const ftensor &tensor, Sink &sink, const SaveOptions &options) {
+            CHECK(!tensor.empty()) << "tensor is empty";
+            CHECK_GT(options.chunk_bytes, 0);
+
+            Header header;
+            header.compression = options.compression;
+            if (!compression_available(header.compression)) {
+                LOG(WARNING) << "compression " << static_cast<int>(header.compression)
+                             << " is not available, the tensor is stored uncompressed";
+                header.compression = Compression::kNone;
+            }
+            const std::vector<uint32_t> &raw_shape = tensor.raw_shapes();
+            header.rank = static_cast<uint8_t>(raw_shape.size());
+            std::copy(raw_shape.begin(), raw_shape.end(), header.raw_shape);
+            header.rows = tensor.rows();
+            header.cols = tensor.cols();
+            header.channels = tensor.channels();
+            // keep chunks aligned to whole floats
+            header.chunk_bytes = std::max<uint32_t>(options.chunk_bytes / sizeof(float), 1) * sizeof(float);
+
+            char buffer[kHeaderBytes] = {};
+            std::memcpy(buffer, kMagic, sizeof(kMagic));
+            buffer[4] = static_cast<char>(header.version);
+            buffer[5] = static_cast<char>(header.dtype);
+            buffer[6] = static_cast<char>(header.layout);
+            buffer[7] = static_cast<char>(header.compression);
+            buffer[8] = static_cast<char>(header.rank);
+            for (uint32_t i = 0; i < 3; ++i) {
+                put_u32(buffer + 12 + i * 4, header.raw_shape[i]);
+            }
+            put_u32(buffer + 24, header.rows);
+            put_u32(buffer + 28, header.cols);
+            put_u32(buffer + 32, header.channels);
+            put_u32(buffer + 36, header.chunk_bytes);
+            sink.write(buffer, kHeaderBytes);
+
+            const char *data = reinterpret_cast<const char *>(tensor.data().memptr());
+            const size_t total = static_cast<size_t>(tensor.size()) * sizeof(float);
+            std::vector<char> scratch;
+            if (header.compression != Compression::kNone) {
+                scratch.resize(compress_bound(header.compression, header.chunk_bytes));
+            }
+            for (size_t offset = 0; offset < total; offset += header.chunk_bytes) {
+                const size_t bytes = std::min<size_t>(header.chunk_bytes, total - offset);
+                size_t stored = 0;
+                if (header.compression != Compression::kNone) {
+                    stored = compress(header.compression, options.level, data + offset, bytes,
+                                      scratch.data(), scratch.size());
+                }
+                char chunk_header[8];
+                put_u32(chunk_header, static_cast<uint32_t>(bytes));
+                put_u32(chunk_header + 4, static_cast<uint32_t>(stored > 0 ? stored : bytes));
+                sink.write(chunk_header, sizeof(chunk_header));
+                if (stored > 0) {
+                    sink.write(scratch.data(), stored);
+                } else {
+                    sink.write(data + offset, bytes);
+                }
+            }
+        }
+
+        ftensor load(Source &source) {
+            MemoryScope scope("load_tensor");
+            char buffer[kHeaderBytes];
+            source.read(buffer, kHeaderBytes);
+            CHECK(std::memcmp(buffer, kMagic, sizeof(kMagic)) == 0) << "not a tensor stream";
+
+            Header header;
+            header.version = static_cast<uint8_t>(buffer[4]);
+            header.dtype = static_cast<uint8_t>(buffer[5]);
+            header.layout = static_cast<uint8_t>(buffer[6]);
+            header.compression = static_cast<Compression>(buffer[7]);
+            header.rank = static_cast<uint8_t>(buffer[8]);
+            CHECK_EQ(header.version, kVersion) << "unsupported tensor format version";
+            CHECK_EQ(header.dtype, kDtypeFloat32) << "unsupported dtype";
+            CHECK_EQ(header.layout, kLayoutColMajor) << "unsupported layout";
+            CHECK(header.rank >= 1 && header.rank <= 3) << "invalid rank";
+            for (uint32_t i = 0; i < 3; ++i) {
+                header.raw_shape[i] = get_u32(buffer + 12 + i * 4);
+            }
+            header.rows = get_u32(buffer + 24);
+            header.cols = get_u32(buffer + 28);
+            header.channels = get_u32(buffer + 32);
+            header.chunk_bytes = get_u32(buffer + 36);
+            CHECK(header.rows > 0 && header.cols > 0 && header.channels > 0) << "invalid shape";
+            // a corrupt shape must not allocate before any payload is read, nor overflow tensor.size()
+            const uint64_t elements = uint64_t(header.rows) * header.cols * header.channels;
+            CHECK_LE(elements, std::numeric_limits<uint32_t>::max()) << "invalid shape";
+            uint64_t raw_elements = 1;
+            for (uint32_t i = 0; i < header.rank; ++i) {
+                raw_elements *= header.raw_shape[i];
+            }
+            CHECK_EQ(raw_elements, elements) << "invalid shape";
+
+            ftensor tensor(header.channels, header.rows, header.cols);
+            const std::vector<uint32_t> raw_shape(header.raw_shape, header.raw_shape + header.rank);
+            if (raw_shape != tensor.raw_shapes()) {
+                // e.g. a padded 1-channel tensor keeps its 3-dim raw shape, the data does not move
+                tensor.reshape(raw_shape, false);
+            }
+
+            char *data = reinterpret_cast<char *>(tensor.data().memptr());
+            const size_t total = static_cast<size_t>(tensor.size()) * sizeof(float);
+            std::vector<char> scratch;
+            for (size_t offset = 0; offset < total;) {
+                char chunk_header[8];
+                source.read(chunk_header, sizeof(chunk_header));
+                const uint32_t bytes = get_u32(chunk_header);
+                const uint32_t stored = get_u32(chunk_header + 4);
+                CHECK(bytes > 0 && bytes <= total - offset) << "invalid chunk size";
+                if (stored == bytes) {
+                    source.read(data + offset, bytes);
+                } else {
+                    // a corrupt length must not turn into a huge allocation
+                    CHECK(header.compression != Compression::kNone &&
+                          stored < compress_bound(header.compression, bytes)) << "invalid chunk size";
+                    scratch.resize(stored);
+                    source.read(scratch.data(), stored);
+                    decompress(header.compression, scratch.data(), stored, data + offset, bytes);
+                }
+                offset += bytes;
+            }
+            return tensor;
+        }
+    }
+
+    bool compression_available(Compression compression) {
+        switch (compression) {
+            case Compression::kNone:
+                return true;
+            case Compression::kZstd:
+#ifdef WONTON_WITH_ZSTD
+                return true;
+#else
+                return false;
+#endif
+            case Compression::kLz4:
+#ifdef WONTON_WITH_LZ4
+                return true;
+#else
+                return false;
+#endif
+        }
+        return false;
+    }
+
+    void save_tensor(const ftensor &tensor, std::ostream &stream, const SaveOptions &options) {
+        StreamSink sink(stream);
+        save(tensor, sink, options);
+    }
+
+    void save_tensor(const ftensor &tensor, const std::string &path, const SaveOptions &options) {
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        CHECK(file.is_open()) << "can not open " << path;
+        save_tensor(tensor, file, options);
+    }
+
+    void save_tensor_fd(const ftensor &tensor, int fd, const SaveOptions &options) {
+        FdSink sink(fd);
+        save(tensor, sink, options);
+    }
+
+    ftensor load_tensor(std::istream &stream) {
+        StreamSource source(stream);
+        return load(source);
+    }
+
+    ftensor load_tensor(const std::string &path) {
+        std::ifstream file(path, std::ios::binary);
+        CHECK(file.is_open()) << "can not open " << path;
+        return load_tensor(file);
+    }
+
+    ftensor load_tensor_fd(int fd) {
+        FdSource source(fd);
+        return load(source);
+    }
+}
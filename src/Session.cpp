@@ -0,0 +1,205 @@
+/**
+  *******************************************************
+  * @file           : Session.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/16
+  *******************************************************
+  */
+
+#include <Session.h>
+#include <Memory.h>
+#include <glog/logging.h>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+namespace wonton {
+    namespace {
+        constexpr double kBucketsPerOctave = InferenceSession::kLatencyBucketsPerOctave;
+
+        uint32_t latency_bucket(std::chrono::steady_clock::duration latency) {
+            const double us = std::chrono::duration<double, std::micro>(latency).count();
+            if (us < 1.) {
+                return 0;
+            }
+            const auto bucket = static_cast<uint64_t>(std::log2(us) * kBucketsPerOctave);
+            return static_cast<uint32_t>(std::min<uint64_t>(bucket, InferenceSession::kLatencyBuckets - 1));
+        }
+
+        // the geometric middle of the bucket that holds the sample of rank p * requests
+        double percentile(const std::array<uint64_t, InferenceSession::kLatencyBuckets> &buckets,
+                          uint64_t requests, double p) {
+            if (requests == 0) {
+                return 0.;
+            }
+            const auto rank = std::min(requests - 1, static_cast<uint64_t>(p * static_cast<double>(requests)));
+            uint64_t count = 0;
+            uint32_t bucket = 0;
+            for (; bucket + 1 < buckets.size(); ++bucket) {
+                count += buckets[bucket];
+                if (count > rank) {
+                    break;
+                }
+            }
+            return std::exp2((bucket + 0.5) / kBucketsPerOctave) / 1000.;
+        }
+
+        std::exception_ptr session_error(const char *message) {
+            return std::make_exception_ptr(std::runtime_error(message));
+        }
+    }
+
+    InferenceSession::InferenceSession(BatchFunction forward, BatchOptions options)
+            : forward_(std::move(forward)), options_(options) {
+        CHECK(this->forward_) << "forward function is empty";
+        CHECK_GT(this->options_.max_batch_size, 0) << "max batch size must be positive";
+        this->worker_ = std::thread(&InferenceSession::run, this);
+    }
+
+    InferenceSession::~InferenceSession() {
+        this->stop();
+    }
+
+    std::future<ftensor> InferenceSession::submit(ftensor input) {
+        CHECK(!input.empty()) << "input is empty";
+        Request request;
+        request.input = std::move(input);
+        request.enqueue_time = Clock::now();
+        std::future<ftensor> result = request.result.get_future();
+        {
+            std::lock_guard<std::mutex> lock(this->queue_mutex_);
+            if (this->stopping_) {
+                request.result.set_exception(session_error("session is stopped"));
+                return result;
+            }
+            this->queue_.push_back(std::move(request));
+        }
+        this->queue_cond_.notify_one();
+        return result;
+    }
+
+    void InferenceSession::stop() {
+        {
+            std::lock_guard<std::mutex> lock(this->queue_mutex_);
+            this->stopping_ = true;
+        }
+        this->queue_cond_.notify_one();
+        if (this->worker_.joinable()) {
+            this->worker_.join();
+        }
+    }
+
+    void InferenceSession::run() {
+        const size_t max_batch_size = this->options_.max_batch_size;
+        while (true) {
+            std::vector<Request> batch;
+            {
+                std::unique_lock<std::mutex> lock(this->queue_mutex_);
+                this->queue_cond_.wait(lock, [this] { return this->stopping_ || !this->queue_.empty(); });
+                if (this->queue_.empty()) {
+                    break;  // stopped and drained
+                }
+                // wait for the batch to fill, but never longer than max_wait after the oldest request
+                const Clock::time_point deadline = this->queue_.front().enqueue_time + this->options_.max_wait;
+                this->queue_cond_.wait_until(lock, deadline, [this, max_batch_size] {
+                    return this->stopping_ || this->queue_.size() >= max_batch_size;
+                });
+
+                // only samples of the same shape can be stacked, the others start the next batch
+                const std::vector<uint32_t> shapes = this->queue_.front().input.shapes();
+                while (!this->queue_.empty() && batch.size() < max_batch_size &&
+                       this->queue_.front().input.shapes() == shapes) {
+                    batch.push_back(std::move(this->queue_.front()));
+                    this->queue_.pop_front();
+                }
+            }
+            this->process(batch);
+        }
+    }
+
+    void InferenceSession::process(std::vector<Request> &batch) {
+        MemoryScope scope("InferenceSession::batch");
+        const auto batch_size = static_cast<uint32_t>(batch.size());
+        const ftensor &first = batch.front().input;
+        const uint32_t channels = first.channels();
+        const uint32_t sample_size = first.size();
+
+        // gather: request i owns channels [i * channels, (i + 1) * channels)
+        ftensor inputs(batch_size * channels, first.rows(), first.cols());
+        float *input_ptr = inputs.data().memptr();
+        for (uint32_t i = 0; i < batch_size; ++i) {
+            const arma::fcube &sample = std::as_const(batch.at(i).input).data();   // never copies a shared input
+            std::copy(sample.begin(), sample.end(), input_ptr + i * sample_size);
+        }
+
+        ftensor outputs;
+        try {
+            outputs = this->forward_(inputs, batch_size);
+        } catch (...) {
+            for (auto &request: batch) {
+                request.result.set_exception(std::current_exception());
+            }
+            return;
+        }
+        // a bad output fails this batch, not the process
+        if (outputs.empty() || outputs.channels() % batch_size != 0) {
+            const std::exception_ptr error = session_error(outputs.empty() ? "forward returns an empty tensor" :
+                                                           "output channels can not be split into the batch");
+            for (auto &request: batch) {
+                request.result.set_exception(error);
+            }
+            return;
+        }
+
+        // scatter
+        const uint32_t out_channels = outputs.channels() / batch_size;
+        const uint32_t out_size = out_channels * outputs.rows() * outputs.cols();
+        const float *output_ptr = std::as_const(outputs).data().memptr();
+        for (uint32_t i = 0; i < batch_size; ++i) {
+            ftensor output(out_channels, outputs.rows(), outputs.cols());
+            std::copy(output_ptr + i * out_size, output_ptr + (i + 1) * out_size, output.data().memptr());
+            batch.at(i).result.set_value(std::move(output));
+        }
+
+        const Clock::time_point now = Clock::now();
+        std::lock_guard<std::mutex> lock(this->stats_mutex_);
+        for (const auto &request: batch) {
+            if (this->first_enqueue_ == Clock::time_point() || request.enqueue_time < this->first_enqueue_) {
+                this->first_enqueue_ = request.enqueue_time;
+            }
+            this->latency_buckets_[latency_bucket(now - request.enqueue_time)] += 1;
+        }
+        this->requests_ += batch.size();
+        this->last_complete_ = now;
+        this->batches_ += 1;
+    }
+
+    SessionStats InferenceSession::stats() const {
+        std::lock_guard<std::mutex> lock(this->stats_mutex_);
+        SessionStats stats;
+        stats.requests = this->requests_;
+        stats.batches = this->batches_;
+        if (stats.batches > 0) {
+            stats.avg_batch_size = static_cast<double>(stats.requests) / static_cast<double>(stats.batches);
+        }
+        stats.p50_latency_ms = percentile(this->latency_buckets_, this->requests_, 0.50);
+        stats.p99_latency_ms = percentile(this->latency_buckets_, this->requests_, 0.99);
+        stats.peak_memory_bytes = MemoryTracker::stats().peak_bytes;
+        const double elapsed = std::chrono::duration<double>(this->last_complete_ - this->first_enqueue_).count();
+        if (elapsed > 0.) {
+            stats.throughput = static_cast<double>(stats.requests) / elapsed;
+        }
+        return stats;
+    }
+
+    void InferenceSession::reset_stats() {
+        std::lock_guard<std::mutex> lock(this->stats_mutex_);
+        this->latency_buckets_.fill(0);
+        this->requests_ = 0;
+        this->batches_ = 0;
+        this->first_enqueue_ = Clock::time_point();
+        this->last_complete_ = Clock::time_point();
+    }
+}
@@ -0,0 +1,329 @@
+/**
+  *******************************************************
+  * @file           : Sparse.cpp
+  * @author         : Mebius
+  * @brief          : None
+  * @date           : 2024/3/20
+  *******************************************************
+  */
+
+#include <Sparse.h>
+#include <Memory.h>
+#include <Parallel.h>
+#include <glog/logging.h>
+#include <cmath>
+
+namespace wonton {
+    namespace {
+        const arma::fmat &tensor_matrix(const ftensor &tensor) {
+            CHECK(!tensor.empty()) << "tensor is empty";
+            CHECK_EQ(tensor.channels(), 1) << "only 1 or 2 dim tensors can be sparse";
+            return tensor.slice(0);
+        }
+
+        // out(:, j) = a * b(:, j) for j in [begin, end), fixed block size
+        template<uint32_t BR, uint32_t BC>
+        void block_spmm(const BlockSparseMatrix &a, const arma::fmat &b, arma::fmat &out,
+                        uint32_t begin, uint32_t end) {
+            const std::vector<uint32_t> &offsets = a.block_offsets();
+            const std::vector<uint32_t> &indices = a.block_indices();
+            const float *values = a.values().data();
+            const uint32_t block_rows = offsets.size() - 1;
+            for (uint32_t j = begin; j < end; ++j) {
+                const float *b_col = b.colptr(j);
+                float *out_col = out.colptr(j);
+                for (uint32_t br = 0; br < block_rows; ++br) {
+                    float acc[BR] = {};
+                    for (uint32_t p = offsets[br]; p < offsets[br + 1]; ++p) {
+                        const uint32_t col = indices[p] * BC;
+                        const float *block = values + p * BR * BC;
+                        const uint32_t width = std::min(BC, a.cols() - col);
+                        if (width == BC) {
+                            for (uint32_t r = 0; r < BR; ++r) {
+                                for (uint32_t c = 0; c < BC; ++c) {
+                                    acc[r] += block[r * BC + c] * b_col[col + c];
+                                }
+                            }
+                        } else {
+                            for (uint32_t r = 0; r < BR; ++r) {
+                                for (uint32_t c = 0; c < width; ++c) {
+                                    acc[r] += block[r * BC + c] * b_col[col + c];
+                                }
+                            }
+                        }
+                    }
+                    const uint32_t height = std::min(BR, a.rows() - br * BR);
+                    for (uint32_t r = 0; r < height; ++r) {
+                        out_col[br * BR + r] = acc[r];
+                    }
+                }
+            }
+        }
+
+        // any block size
+        void block_spmm_generic(const BlockSparseMatrix &a, const arma::fmat &b, arma::fmat &out,
+                                uint32_t begin, uint32_t end) {
+            const uint32_t bh = a.block_rows(), bw = a.block_cols();
+            const std::vector<uint32_t> &offsets = a.block_offsets();
+            const std::vector<uint32_t> &indices = a.block_indices();
+            const float *values = a.values().data();
+            for (uint32_t j = begin; j < end; ++j) {
+                const float *b_col = b.colptr(j);
+                float *out_col = out.colptr(j);
+                for (uint32_t br = 0; br + 1 < offsets.size(); ++br) {
+                    const uint32_t height = std::min(bh, a.rows() - br * bh);
+                    for (uint32_t p = offsets[br]; p < offsets[br + 1]; ++p) {
+                        const uint32_t col = indices[p] * bw;
+                        const uint32_t width = std::min(bw, a.cols() - col);
+                        const float *block = values + p * bh * bw;
+                        for (uint32_t r = 0; r < height; ++r) {
+                            for (uint32_t c = 0; c < width; ++c) {
+                                out_col[br * bh + r] += block[r * bw + c] * b_col[col + c];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    CsrMatrix CsrMatrix::from_dense(const arma::fmat &dense, float threshold) {
+        CsrMatrix matrix;
+        matrix.rows_ = dense.n_rows;
+        matrix.cols_ = dense.n_cols;
+        matrix.row_offsets_.reserve(dense.n_rows + 1);
+        matrix.row_offsets_.push_back(0);
+        for (uint32_t i = 0; i < dense.n_rows; ++i) {
+            for (uint32_t j = 0; j < dense.n_cols; ++j) {
+                const float value = dense.at(i, j);
+                if (std::fabs(value) > threshold) {
+                    matrix.col_indices_.push_back(j);
+                    matrix.values_.push_back(value);
+                }
+            }
+            matrix.row_offsets_.push_back(matrix.values_.size());
+        }
+        return matrix;
+    }
+
+    CsrMatrix CsrMatrix::from_tensor(const ftensor &tensor, float threshold) {
+        return from_dense(tensor_matrix(tensor), threshold);
+    }
+
+    float CsrMatrix::sparsity() const {
+        const double size = double(this->rows_) * double(this->cols_);
+        return size > 0 ? float(1. - double(this->nnz()) / size) : 0.f;
+    }
+
+    arma::fmat CsrMatrix::to_dense() const {
+        arma::fmat dense(this->rows_, this->cols_);
+        dense.zeros();
+        for (uint32_t i = 0; i < this->rows_; ++i) {
+            for (uint32_t p = this->row_offsets_.at(i); p < this->row_offsets_.at(i + 1); ++p) {
+                dense.at(i, this->col_indices_.at(p)) = this->values_.at(p);
+            }
+        }
+        return dense;
+    }
+
+    BlockSparseMatrix BlockSparseMatrix::from_dense(const arma::fmat &dense, uint32_t block_rows,
+                                                    uint32_t block_cols, float threshold) {
+        CHECK(block_rows > 0 && block_cols > 0) << "block size must be positive";
+        BlockSparseMatrix matrix;
+        matrix.rows_ = dense.n_rows;
+        matrix.cols_ = dense.n_cols;
+        matrix.block_rows_ = block_rows;
+        matrix.block_cols_ = block_cols;
+        const uint32_t grid_rows = (matrix.rows_ + block_rows - 1) / block_rows;
+        const uint32_t grid_cols = (matrix.cols_ + block_cols - 1) / block_cols;
+        matrix.block_offsets_.reserve(grid_rows + 1);
+        matrix.block_offsets_.push_back(0);
+        for (uint32_t br = 0; br < grid_rows; ++br) {
+            for (uint32_t bc = 0; bc < grid_cols; ++bc) {
+                bool keep = false;
+                for (uint32_t r = br * block_rows; r < std::min((br + 1) * block_rows, matrix.rows_) && !keep; ++r) {
+                    for (uint32_t c = bc * block_cols; c < std::min((bc + 1) * block_cols, matrix.cols_); ++c) {
+                        if (std::fabs(dense.at(r, c)) > threshold) {
+                            keep = true;
+                            break;
+                        }
+                    }
+                }
+                if (!keep) {
+                    continue;
+                }
+                matrix.block_indices_.push_back(bc);
+                for (uint32_t r = 0; r < block_rows; ++r) {
+                    for (uint32_t c = 0; c < block_cols; ++c) {
+                        const uint32_t row = br * block_rows + r, col = bc * block_cols + c;
+                        matrix.values_.push_back(row < matrix.rows_ && col < matrix.cols_ ? dense.at(row, col) : 0.f);
+                    }
+                }
+            }
+            matrix.block_offsets_.push_back(matrix.block_indices_.size());
+        }
+        return matrix;
+    }
+
+    BlockSparseMatrix BlockSparseMatrix::from_tensor(const ftensor &tensor, uint32_t block_rows,
+                                                     uint32_t block_cols, float threshold) {
+        return from_dense(tensor_matrix(tensor), block_rows, block_cols, threshold);
+    }
+
+    float BlockSparseMatrix::sparsity() const {
+        const double size = double(this->rows_) * double(this->cols_);
+        const double stored = double(this->blocks()) * this->block_rows_ * this->block_cols_;
+        return size > 0 ? float(std::max(0., 1. - stored / size)) : 0.f;
+    }
+
+    arma::fmat BlockSparseMatrix::to_dense() const {
+        arma::fmat dense(this->rows_, this->cols_);
+        dense.zeros();
+        for (uint32_t br = 0; br + 1 < this->block_offsets_.size(); ++br) {
+            for (uint32_t p = this->block_offsets_.at(br); p < this->block_offsets_.at(br + 1); ++p) {
+                const float *block = this->values_.data() + p * this->block_rows_ * this->block_cols_;
+                for (uint32_t r = 0; r < this->block_rows_; ++r) {
+                    for (uint32_t c = 0; c < this->block_cols_; ++c) {
+                        const uint32_t row = br * this->block_rows_ + r;
+                        const uint32_t col = this->block_indices_.at(p) * this->block_cols_ + c;
+                        if (row < this->rows_ && col < this->cols_) {
+                            dense.at(row, col) = block[r * this->block_cols_ + c];
+                        }
+                    }
+                }
+            }
+        }
+        return dense;
+    }
+
+    arma::fmat spmm(const CsrMatrix &a, const arma::fmat &b, uint32_t threads) {
+        CHECK_EQ(a.cols(), b.n_rows) << "inner dimensions are not equal";
+        arma::fmat out(a.rows(), b.n_cols);
+        const std::vector<uint32_t> &offsets = a.row_offsets();
+        const uint32_t *indices = a.col_indices().data();
+        const float *values = a.values().data();
+        parallel_for(0, b.n_cols, threads, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t j = begin; j < end; ++j) {
+                const float *b_col = b.colptr(j);
+                float *out_col = out.colptr(j);
+                for (uint32_t i = 0; i < a.rows(); ++i) {
+                    float sum = 0.f;
+                    for (uint32_t p = offsets[i]; p < offsets[i + 1]; ++p) {
+                        sum += values[p] * b_col[indices[p]];
+                    }
+                    out_col[i] = sum;
+                }
+            }
+        });
+        return out;
+    }
+
+    arma::fmat spmm(const BlockSparseMatrix &a, const arma::fmat &b, uint32_t threads) {
+        CHECK_EQ(a.cols(), b.n_rows) << "inner dimensions are not equal";
+        arma::fmat out(a.rows(), b.n_cols);
+        out.zeros();
+        parallel_for(0, b.n_cols, threads, [&](uint32_t begin, uint32_t end) {
+            if (a.block_rows() == 1 && a.block_cols() == 4) {
+                block_spmm<1, 4>(a, b, out, begin, end);
+            } else if (a.block_rows() == 4 && a.block_cols() == 4) {
+                block_spmm<4, 4>(a, b, out, begin, end);
+            } else {
+                block_spmm_generic(a, b, out, begin, end);
+            }
+        });
+        return out;
+    }
+
+    arma::fmat kernel_matrix(const std::vector<ftensor> &kernels) {
+        CHECK(!kernels.empty()) << "kernels are empty";
+        const uint32_t kernel_size = kernels.front().size();
+        arma::fmat matrix(kernels.size(), kernel_size);
+        for (uint32_t k = 0; k < kernels.size(); ++k) {
+            CHECK(kernels.at(k).shapes() == kernels.front().shapes()) << "kernels have different shapes";
+            const float *kernel = kernels.at(k).data().memptr();
+            for (uint32_t i = 0; i < kernel_size; ++i) {
+                matrix.at(k, i) = kernel[i];
+            }
+        }
+        return matrix;
+    }
+
+    ftensor conv2d(const ftensor &input, const CsrMatrix &kernels, uint32_t kernel_h, uint32_t kernel_w,
+                   const ConvParams &params, uint32_t threads) {
+        MemoryScope scope("conv2d(csr)");
+        CHECK_EQ(kernels.cols(), input.channels() * kernel_h * kernel_w) << "kernel size is not equal to the input";
+        const std::vector<uint32_t> out_shape = conv2d_output_shape(input, kernel_h, kernel_w, params);
+        const arma::fmat input_cols = im2col(input, kernel_h, kernel_w, params, threads);
+        const TrackedBytes cols_bytes(input_cols.n_elem * sizeof(float));
+        const uint32_t out_plane = input_cols.n_rows;
+
+        ftensor output(kernels.rows(), out_shape.at(0), out_shape.at(1));
+        output.zeros();
+        float *out = output.data().memptr();
+        const std::vector<uint32_t> &offsets = kernels.row_offsets();
+        const std::vector<uint32_t> &indices = kernels.col_indices();
+        const std::vector<float> &values = kernels.values();
+        // output channel k only touches the input columns of its kept weights
+        parallel_for(0, kernels.rows(), threads, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t k = begin; k < end; ++k) {
+                float *out_k = out + k * out_plane;
+                for (uint32_t p = offsets[k]; p < offsets[k + 1]; ++p) {
+                    const float w = values[p];
+                    const float *col = input_cols.colptr(indices[p]);
+                    for (uint32_t n = 0; n < out_plane; ++n) {
+                        out_k[n] += w * col[n];
+                    }
+                }
+            }
+        });
+        return output;
+    }
+
+    ftensor conv2d(const ftensor &input, const BlockSparseMatrix &kernels, uint32_t kernel_h, uint32_t kernel_w,
+                   const ConvParams &params, uint32_t threads) {
+        MemoryScope scope("conv2d(block sparse)");
+        CHECK_EQ(kernels.cols(), input.channels() * kernel_h * kernel_w) << "kernel size is not equal to the input";
+        const std::vector<uint32_t> out_shape = conv2d_output_shape(input, kernel_h, kernel_w, params);
+        const arma::fmat input_cols = im2col(input, kernel_h, kernel_w, params, threads);
+        const TrackedBytes cols_bytes(input_cols.n_elem * sizeof(float));
+        const uint32_t out_plane = input_cols.n_rows;
+
+        ftensor output(kernels.rows(), out_shape.at(0), out_shape.at(1));
+        output.zeros();
+        float *out = output.data().memptr();
+        const uint32_t bh = kernels.block_rows(), bw = kernels.block_cols();
+        const std::vector<uint32_t> &offsets = kernels.block_offsets();
+        const std::vector<uint32_t> &indices = kernels.block_indices();
+        const float *values = kernels.values().data();
+        parallel_for(0, offsets.size() - 1, threads, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t br = begin; br < end; ++br) {
+                const uint32_t height = std::min(bh, kernels.rows() - br * bh);
+                for (uint32_t p = offsets[br]; p < offsets[br + 1]; ++p) {
+                    const uint32_t col = indices[p] * bw;
+                    const uint32_t width = std::min(bw, kernels.cols() - col);
+                    const float *block = values + p * bh * bw;
+                    for (uint32_t r = 0; r < height; ++r) {
+                        float *out_k = out + (br * bh + r) * out_plane;
+                        const float *w = block + r * bw;
+                        if (width == 4) {
+                            // one pass over the output for the four weights of a block row
+                            const float *c0 = input_cols.colptr(col), *c1 = input_cols.colptr(col + 1);
+                            const float *c2 = input_cols.colptr(col + 2), *c3 = input_cols.colptr(col + 3);
+                            for (uint32_t n = 0; n < out_plane; ++n) {
+                                out_k[n] += w[0] * c0[n] + w[1] * c1[n] + w[2] * c2[n] + w[3] * c3[n];
+                            }
+                        } else {
+                            for (uint32_t c = 0; c < width; ++c) {
+                                const float *in_col = input_cols.colptr(col + c);
+                                for (uint32_t n = 0; n < out_plane; ++n) {
+                                    out_k[n] += w[c] * in_col[n];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+        return output;
+    }
+}
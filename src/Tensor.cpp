@@ -8,16 +8,67 @@
   */
 
 #include <Tensor.h>
+#include <Memory.h>
 #include <glog/logging.h>
+#include <atomic>
 
 namespace wonton {
+    namespace {
+        std::atomic<uint64_t> shared_copies{0};
+        std::atomic<uint64_t> deep_copies{0};
+
+        uint64_t cube_bytes(const arma::fcube &cube) {
+            return static_cast<uint64_t>(cube.n_elem) * sizeof(float);
+        }
+
+        // releases the bytes a buffer was last recorded with
+        struct CubeDeleter {
+            uint64_t bytes;
+            void operator()(arma::fcube *data) const {
+                MemoryTracker::release(this->bytes);
+                delete data;
+            }
+        };
+
+        // every tensor buffer is recorded by the MemoryTracker from its creation to its last owner
+        template<typename... Args>
+        std::shared_ptr<arma::fcube> make_cube(Args &&... args) {
+            auto *cube = new arma::fcube(std::forward<Args>(args)...);
+            const uint64_t bytes = cube_bytes(*cube);
+            MemoryTracker::allocate(bytes);
+            return std::shared_ptr<arma::fcube>(cube, CubeDeleter{bytes});
+        }
+
+        // a buffer resized through a reference from data() is recorded again, only called by its sole owner
+        void record_resize(const std::shared_ptr<arma::fcube> &data) {
+            auto *deleter = std::get_deleter<CubeDeleter>(data);
+            const uint64_t bytes = cube_bytes(*data);
+            if (deleter != nullptr && deleter->bytes != bytes) {
+                MemoryTracker::allocate(bytes);
+                MemoryTracker::release(deleter->bytes);
+                deleter->bytes = bytes;
+            }
+        }
+    }
+
+    Tensor<float>::Tensor(const Tensor &tensor) {
+        this->copy_from(tensor);
+    }
+
+    Tensor<float> &Tensor<float>::operator=(const Tensor &tensor) {
+        if (this != &tensor) {
+            this->copy_from(tensor);
+        }
+        return *this;
+    }
+
     Tensor<float>::Tensor(uint32_t length) {
-        this->raw_data = arma::fcube(1, length, 1); // [n_rows, n_cols, n_slices]
+        this->raw_data = make_cube(1, length, 1); // [n_rows, n_cols, n_slices]
         this->raw_shape = std::vector<uint32_t>{length};
     }
 
     Tensor<float>::Tensor(uint32_t rows, uint32_t cols) {
-        this->raw_data = arma::fcube(rows, cols, 1);
+        this->raw_data = make_cube(rows, cols, 1);
         if (rows == 1) {
             this->raw_shape = std::vector<uint32_t>{cols};
         } else {
@@ -26,7 +77,7 @@ namespace wonton {
     }
 
     Tensor<float>::Tensor(uint32_t channels, uint32_t rows, uint32_t cols) {
-        this->raw_data = arma::fcube(rows, cols, channels);
+        this->raw_data = make_cube(rows, cols, channels);
         if (channels == 1 && rows == 1) {
             this->raw_shape = std::vector<uint32_t>{cols};
         } else if (channels == 1) {
@@ -46,7 +97,7 @@ namespace wonton {
         uint32_t rows = shapes_[1];
         uint32_t cols = shapes_[2];
 
-        this->raw_data = arma::fcube(rows, cols, channels);
+        this->raw_data = make_cube(rows, cols, channels);
         if (channels == 1 && rows == 1) {
             this->raw_shape = std::vector<uint32_t>{cols};
         } else if (channels == 1) {
@@ -57,23 +108,23 @@ namespace wonton {
     }
 
     uint32_t Tensor<float>::rows() const {
-        CHECK(!this->raw_data.empty());
-        return this->raw_data.n_rows;
+        CHECK(!this->cube().empty());
+        return this->cube().n_rows;
     }
 
     uint32_t Tensor<float>::cols() const {
-        CHECK(!this->raw_data.empty());
-        return this->raw_data.n_cols;
+        CHECK(!this->cube().empty());
+        return this->cube().n_cols;
     }
 
     uint32_t Tensor<float>::channels() const {
-        CHECK(!this->raw_data.empty());
-        return this->raw_data.n_slices;
+        CHECK(!this->cube().empty());
+        return this->cube().n_slices;
     }
 
     uint32_t Tensor<float>::size() const {
-        CHECK(!this->raw_data.empty());
-        return this->raw_data.size();
+        CHECK(!this->cube().empty());
+        return this->cube().size();
     }
 
     std::vector<uint32_t> Tensor<float>::shapes() const {
@@ -88,67 +139,86 @@ namespace wonton {
     }
 
     float Tensor<float>::index(uint32_t offset) const {
-        CHECK(!this->raw_data.empty());
+        CHECK(!this->cube().empty());
         CHECK_LT(offset, this->size()) << "offset is out of range";
-        return this->raw_data.at(offset);
+        return this->cube().at(offset);
     }
 
     float &Tensor<float>::index(uint32_t offset) {
-        CHECK(!this->raw_data.empty());
+        CHECK(!this->cube().empty());
         CHECK_LT(offset, this->size()) << "offset is out of range";
-        return this->raw_data.at(offset);
+        return this->exposed_cube().at(offset);
     }
 
     bool Tensor<float>::empty() const {
-        return this->raw_data.empty();
+        return this->cube().empty();
     }
 
     void Tensor<float>::set_data(const arma::fcube &data) {
-        CHECK(data.n_rows == this->raw_data.n_rows) << "rows is not equal";
-        CHECK(data.n_cols == this->raw_data.n_cols) << "cols is not equal";
-        CHECK(data.n_slices == this->raw_data.n_slices) << "channels is not equal";
-        this->raw_data = data;
+        CHECK(data.n_rows == this->cube().n_rows) << "rows is not equal";
+        CHECK(data.n_cols == this->cube().n_cols) << "cols is not equal";
+        CHECK(data.n_slices == this->cube().n_slices) << "channels is not equal";
+        if (this->owns_cube()) {
+            *this->raw_data = data;
+            record_resize(this->raw_data);
+        } else {
+            this->raw_data = make_cube(data);
+            this->unshareable = false;
+        }
+    }
+
+    void Tensor<float>::set_data(arma::fcube &&data) {
+        CHECK(data.n_rows == this->cube().n_rows) << "rows is not equal";
+        CHECK(data.n_cols == this->cube().n_cols) << "cols is not equal";
+        CHECK(data.n_slices == this->cube().n_slices) << "channels is not equal";
+        if (this->owns_cube()) {
+            *this->raw_data = std::move(data);
+            record_resize(this->raw_data);
+        } else {
+            this->raw_data = make_cube(std::move(data));
+            this->unshareable = false;
+        }
     }
 
     arma::fcube &Tensor<float>::data() {
-        return this->raw_data;
+        return this->exposed_cube();
     }
 
     const arma::fcube &Tensor<float>::data() const {
-        return this->raw_data;
+        return this->cube();
     }
 
     arma::fmat &Tensor<float>::slice(uint32_t channel) {
         CHECK_LE(channel, this->channels()) << "channel is out of range";
-        return this->raw_data.slice(channel);
+        return this->exposed_cube().slice(channel);
     }
 
     const arma::fmat &Tensor<float>::slice(uint32_t channel) const {
         CHECK_LE(channel, this->channels()) << "channel is out of range";
-        return this->raw_data.slice(channel);
+        return this->cube().slice(channel);
     }
 
     float Tensor<float>::at(uint32_t channel, uint32_t row, uint32_t col) const {
         CHECK_LE(channel, this->channels()) << "channel is out of range";
         CHECK_LE(row, this->rows()) << "row is out of range";
         CHECK_LE(col, this->cols()) << "col is out of range";
-        return this->raw_data.at(row, col, channel);
+        return this->cube().at(row, col, channel);
     }
 
     float &Tensor<float>::at(uint32_t channel, uint32_t row, uint32_t col) {
         CHECK_LE(channel, this->channels()) << "channel is out of range";
         CHECK_LE(row, this->rows()) << "row is out of range";
         CHECK_LE(col, this->cols()) << "col is out of range";
-        return this->raw_data.at(row, col, channel);
+        return this->exposed_cube().at(row, col, channel);
     }
 
     void Tensor<float>::fill(float value) {
-        CHECK(!this->raw_data.empty());
-        this->raw_data.fill(value);
+        CHECK(!this->cube().empty());
+        this->overwrite_cube().fill(value);
     }
 
     void Tensor<float>::fill(std::vector<float> values, bool row_major) {
-        CHECK(!this->raw_data.empty());
+        CHECK(!this->cube().empty());
         CHECK_EQ(values.size(), this->size()) << "values size is not equal to tensor size";
         if (row_major) {
             const uint32_t rows = this->rows();
@@ -157,7 +227,7 @@ namespace wonton {
             const uint32_t planes = rows * cols;
 
             for (uint32_t i = 0; i < channels; i++) {
-                auto &channel_data = this->raw_data.slice(i);
+                auto &channel_data = this->overwrite_cube().slice(i);
                 const arma::fmat &channel_data_t = arma::fmat(
                         values.data() + i * planes,
                         cols,
@@ -165,26 +235,26 @@ namespace wonton {
                 channel_data = channel_data_t.t();
             }
         } else {
-            std::copy(values.begin(), values.end(), this->raw_data.memptr());
+            std::copy(values.begin(), values.end(), this->overwrite_cube().memptr());
         }
     }
 
     void Tensor<float>::show() {
         for (uint32_t i = 0; i < this->channels(); ++i) {
             LOG(INFO) << "Channel: " << i;
-            LOG(INFO) << "\n" << this->raw_data.slice(i);
+            LOG(INFO) << "\n" << this->cube().slice(i);
         }
     }
 
     std::vector<float> Tensor<float>::values(bool row_major) {
-        CHECK(!this->raw_data.empty());
-        std::vector<float> values(this->raw_data.size());
+        CHECK(!this->cube().empty());
+        std::vector<float> values(this->cube().size());
         if (!row_major) {
-            std::copy(this->raw_data.begin(), this->raw_data.end(), values.begin());
+            std::copy(this->cube().begin(), this->cube().end(), values.begin());
         } else {
             uint32_t index = 0;
-            for (uint32_t channel = 0; channel < this->raw_data.n_slices; channel++) {
-                const arma::fmat &channel_data = this->raw_data.slice(channel);
+            for (uint32_t channel = 0; channel < this->cube().n_slices; channel++) {
+                const arma::fmat &channel_data = this->cube().slice(channel);
                 std::copy(channel_data.begin(), channel_data.end(), values.begin() + index);
                 index += channel_data.size();
             }
@@ -194,22 +264,23 @@ namespace wonton {
     }
 
     void Tensor<float>::ones() {
-        CHECK(!this->raw_data.empty());
+        CHECK(!this->cube().empty());
         this->fill(1.0f);
     }
 
     void Tensor<float>::zeros() {
-        CHECK(!this->raw_data.empty());
+        CHECK(!this->cube().empty());
         this->fill(0.0f);
     }
 
     void Tensor<float>::rand() {
-        CHECK(!this->raw_data.empty());
-        this->raw_data.randn();
+        CHECK(!this->cube().empty());
+        this->overwrite_cube().randn();
     }
 
     void Tensor<float>::reshape(const std::vector<uint32_t> &shapes, bool row_major) {
-        CHECK(!shapes.empty() && shapes.size() <= 3 && !this->raw_data.empty());
+        MemoryScope scope("Tensor::reshape");
+        CHECK(!shapes.empty() && shapes.size() <= 3 && !this->cube().empty());
         const uint32_t origin_size = this->size();
         const uint32_t current_size = std::accumulate(
                 shapes.begin(),
@@ -220,17 +291,21 @@ namespace wonton {
         CHECK(current_size == origin_size);
 
         std::vector<float> values;
+        TrackedBytes values_bytes;
         if (row_major) {
             values = this->values(true);
+            values_bytes = TrackedBytes(values.size() * sizeof(float));
         }
+        // a row major reshape rewrites every element below, the old data is not needed
+        arma::fcube &data = row_major ? this->overwrite_cube() : this->mutable_cube();
         if (shapes.size() == 3) {
-            this->raw_data.reshape(shapes.at(1), shapes.at(2), shapes.at(0));
+            data.reshape(shapes.at(1), shapes.at(2), shapes.at(0));
             this->raw_shape = {shapes.at(0), shapes.at(1), shapes.at(2)};
         } else if (shapes.size() == 2) {
-            this->raw_data.reshape(shapes.at(0), shapes.at(1), 1);
+            data.reshape(shapes.at(0), shapes.at(1), 1);
             this->raw_shape = {shapes.at(0), shapes.at(1)};
         } else {
-            this->raw_data.reshape(1, shapes.at(0), 1);
+            data.reshape(1, shapes.at(0), 1);
             this->raw_shape = {shapes.at(0)};
         }
 
@@ -240,32 +315,115 @@ namespace wonton {
     }
 
     void Tensor<float>::transform(const std::function<float(float)> &filter) {
-        CHECK(!this->raw_data.empty());
-        this->raw_data.transform(filter);
+        CHECK(!this->cube().empty());
+        this->mutable_cube().transform(filter);
     }
 
     void Tensor<float>::flatten(bool row_major) {
-        CHECK(!this->raw_data.empty());
+        CHECK(!this->cube().empty());
         const uint32_t size = this->size();
         this->reshape({size}, row_major);
     }
 
     void Tensor<float>::padding(const std::vector<uint32_t> &pads, float padding_value) {
-        CHECK(!this->raw_data.empty());
+        MemoryScope scope("Tensor::padding");
+        CHECK(!this->cube().empty());
         CHECK_EQ(pads.size(), 4) << "pads size is not equal to 4";
         uint32_t pad_rows1 = pads.at(0);  // up
         uint32_t pad_rows2 = pads.at(1);  // bottom
         uint32_t pad_cols1 = pads.at(2);  // left
         uint32_t pad_cols2 = pads.at(3);  // right
 
-        arma::Cube<float> new_data(this->raw_data.n_rows + pad_rows1 + pad_rows2,
-                                   this->raw_data.n_cols + pad_cols1 + pad_cols2,
-                                   this->raw_data.n_slices);
+        arma::Cube<float> new_data(this->cube().n_rows + pad_rows1 + pad_rows2,
+                                   this->cube().n_cols + pad_cols1 + pad_cols2,
+                                   this->cube().n_slices);
         new_data.fill(padding_value);
 
         new_data.subcube(pad_rows1, pad_cols1, 0, new_data.n_rows - pad_rows2 - 1,
-                         new_data.n_cols - pad_cols2 - 1, new_data.n_slices - 1) = this->raw_data;
-        this->raw_data = std::move(new_data);
+                         new_data.n_cols - pad_cols2 - 1, new_data.n_slices - 1) = this->cube();
+        // an owned cube is kept, so references to it stay valid; a shared one is left to its other owners
+        if (this->owns_cube()) {
+            *this->raw_data = std::move(new_data);
+            record_resize(this->raw_data);
+        } else {
+            this->raw_data = make_cube(std::move(new_data));
+            this->unshareable = false;
+        }
         this->raw_shape = std::vector<uint32_t>{this->channels(), this->rows(), this->cols()};
     }
+
+    bool Tensor<float>::shared() const {
+        return this->raw_data && this->raw_data.use_count() > 1;
+    }
+
+    CowStats Tensor<float>::cow_stats() {
+        CowStats stats;
+        stats.shared_copies = shared_copies.load();
+        stats.deep_copies = deep_copies.load();
+        return stats;
+    }
+
+    void Tensor<float>::reset_cow_stats() {
+        shared_copies = 0;
+        deep_copies = 0;
+    }
+
+    const arma::fcube &Tensor<float>::cube() const {
+        static const arma::fcube empty_cube;
+        return this->raw_data ? *this->raw_data : empty_cube;
+    }
+
+    arma::fcube &Tensor<float>::mutable_cube() {
+        if (!this->raw_data) {
+            this->raw_data = make_cube();
+        } else if (!this->owns_cube()) {
+            this->raw_data = make_cube(*this->raw_data);
+            deep_copies += 1;
+        } else {
+            record_resize(this->raw_data);
+        }
+        return *this->raw_data;
+    }
+
+    arma::fcube &Tensor<float>::overwrite_cube() {
+        if (!this->raw_data) {
+            this->raw_data = make_cube();
+        } else if (!this->owns_cube()) {
+            const arma::fcube &data = *this->raw_data;
+            this->raw_data = make_cube(data.n_rows, data.n_cols, data.n_slices);
+            this->unshareable = false;
+        } else {
+            record_resize(this->raw_data);
+        }
+        return *this->raw_data;
+    }
+
+    arma::fcube &Tensor<float>::exposed_cube() {
+        arma::fcube &data = this->mutable_cube();
+        this->unshareable = true;
+        return data;
+    }
+
+    void Tensor<float>::copy_from(const Tensor &tensor) {
+        this->raw_shape = tensor.raw_shape;
+        this->unshareable = false;
+        if (tensor.unshareable && tensor.raw_data) {
+            this->raw_data = make_cube(*tensor.raw_data);
+        } else {
+            this->raw_data = tensor.raw_data;
+            if (this->raw_data) {
+                shared_copies += 1;
+            }
+        }
+    }
+
+    bool Tensor<float>::owns_cube() const {
+        if (!this->raw_data || this->raw_data.use_count() > 1) {
+            return false;
+        }
+        // use_count() is a relaxed load: order the reads of the owner that just released its copy
+        // before the writes of this one
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return true;
+    }
 }
@@ -0,0 +1,147 @@
+/**
+  *******************************************************
+  * @file           : ConvolutionTest.cpp
+  * @author         : Mebius
+  * @brief          : test for conv2d and Autotuner
+  * @date           : 2024/3/17
+  *******************************************************
+  */
+#include <Test.h>
+#include <Autotuner.h>
+#include <Convolution.h>
+#include <cstdio>
+#include <thread>
+
+namespace {
+    // reference: out(k, r, c) = sum input(ch, r * s + i - p, c * s + j - p) * kernel(ch, i, j)
+    float reference(const wonton::ftensor &input, const wonton::ftensor &kernel, const wonton::ConvParams &params,
+                    uint32_t r, uint32_t c) {
+        float sum = 0.f;
+        for (uint32_t ch = 0; ch < kernel.channels(); ++ch) {
+            for (uint32_t i = 0; i < kernel.rows(); ++i) {
+                for (uint32_t j = 0; j < kernel.cols(); ++j) {
+                    const int row = int(r * params.stride_h + i) - int(params.pad_h);
+                    const int col = int(c * params.stride_w + j) - int(params.pad_w);
+                    if (row >= 0 && col >= 0 && row < int(input.rows()) && col < int(input.cols())) {
+                        sum += input.at(ch, row, col) * kernel.at(ch, i, j);
+                    }
+                }
+            }
+        }
+        return sum;
+    }
+
+    void check_conv(uint32_t kernel_size, const wonton::ConvParams &params) {
+        using namespace wonton;
+        ftensor input(3, 11, 9);
+        input.rand();
+        std::vector<ftensor> kernels;
+        for (uint32_t k = 0; k < 5; ++k) {
+            ftensor kernel(3, kernel_size, kernel_size);
+            kernel.rand();
+            kernels.push_back(kernel);
+        }
+        std::vector<ConvConfig> configs = conv2d_candidates(kernel_size, kernel_size, params);
+        for (ConvConfig config: conv2d_candidates(kernel_size, kernel_size, params)) {
+            config.threads = 3;     // the chunks must not overlap whatever the core count is
+            configs.push_back(config);
+        }
+        for (const auto &config: configs) {
+            const ftensor output = conv2d(input, kernels, params, config);
+            ASSERT_EQ(output.channels(), 5);
+            ASSERT_EQ(output.rows(), (11 + 2 * params.pad_h - kernel_size) / params.stride_h + 1);
+            ASSERT_EQ(output.cols(), (9 + 2 * params.pad_w - kernel_size) / params.stride_w + 1);
+            for (uint32_t k = 0; k < output.channels(); ++k) {
+                for (uint32_t r = 0; r < output.rows(); ++r) {
+                    for (uint32_t c = 0; c < output.cols(); ++c) {
+                        ASSERT_NEAR(output.at(k, r, c), reference(input, kernels.at(k), params, r, c), 1e-3f)
+                                                    << to_string(config) << " " << k << " " << r << " " << c;
+                    }
+                }
+            }
+        }
+    }
+}
+
+TEST(test_conv, conv3x3) {
+    wonton::ConvParams params;
+    params.pad_h = 1;
+    params.pad_w = 1;
+    check_conv(3, params);
+}
+
+TEST(test_conv, conv_stride) {
+    wonton::ConvParams params;
+    params.stride_h = 2;
+    params.stride_w = 2;
+    check_conv(3, params);
+    check_conv(1, params);
+}
+
+TEST(test_conv, conv5x5) {
+    wonton::ConvParams params;
+    params.pad_h = 2;
+    params.pad_w = 1;
+    check_conv(5, params);
+}
+
+TEST(test_autotuner, cache1) {
+    using namespace wonton;
+    const std::string path = testing::TempDir() + "wonton_tuning_test.cache";
+    std::remove(path.c_str());
+
+    uint32_t runs = 0;
+    std::vector<Autotuner::Candidate> candidates{
+            {"slow", [&runs]() {
+                runs += 1;
+                std::this_thread::sleep_for(std::chrono::milliseconds(2));
+            }},
+            {"fast", [&runs]() { runs += 1; }},
+    };
+    {
+        Autotuner tuner(path);
+        ASSERT_EQ(tuner.select("op", "1x2x3", candidates), 1);
+        ASSERT_GT(runs, 0);
+        ASSERT_EQ(tuner.cache_size(), 1);
+    }
+
+    // a new process on the same host reuses the winner without timing again
+    runs = 0;
+    Autotuner tuner(path);
+    ASSERT_EQ(tuner.cache_size(), 1);
+    ASSERT_EQ(tuner.select("op", "1x2x3", candidates), 1);
+    ASSERT_EQ(runs, 0);
+
+    tuner.set_enabled(false);
+    ASSERT_EQ(tuner.select("op", "4x5x6", candidates, 0), 0);
+    ASSERT_EQ(runs, 0);
+    std::remove(path.c_str());
+}
+
+TEST(test_autotuner, conv_tuned1) {
+    using namespace wonton;
+    ftensor input(8, 32, 32);
+    input.rand();
+    std::vector<ftensor> kernels;
+    for (uint32_t k = 0; k < 16; ++k) {
+        ftensor kernel(8, 3, 3);
+        kernel.rand();
+        kernels.push_back(kernel);
+    }
+    ConvParams params;
+    params.pad_h = 1;
+    params.pad_w = 1;
+    const std::string path = testing::TempDir() + "wonton_conv_tuned.cache";
+    std::remove(path.c_str());
+    Autotuner tuner(path);
+    const ftensor tuned = conv2d(input, kernels, params, tuner);
+    ASSERT_EQ(tuner.cache_size(), 1);
+    std::remove(path.c_str());
+    ConvConfig config;
+    config.algorithm = ConvAlgorithm::kDirect;
+    const ftensor direct = conv2d(input, kernels, params, config);
+    ASSERT_EQ(tuned.shapes(), direct.shapes());
+    for (uint32_t i = 0; i < tuned.size(); ++i) {
+        ASSERT_NEAR(tuned.index(i), direct.index(i), 1e-3f);
+    }
+}
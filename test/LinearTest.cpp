@@ -0,0 +1,79 @@
+/**
+  *******************************************************
+  * @file           : LinearTest.cpp
+  * @author         : Mebius
+  * @brief          : test and benchmark for Linear
+  * @date           : 2024/3/21
+  *******************************************************
+  */
+#include <Test.h>
+#include <Linear.h>
+
+namespace {
+    void check_linear(uint32_t batch, uint32_t in, uint32_t out, uint32_t gemv_max_batch, uint32_t threads) {
+        using namespace wonton;
+        ftensor weights(out, in);
+        weights.rand();
+        ftensor bias(out);
+        bias.rand();
+        ftensor input(batch, in);
+        input.rand();
+
+        Linear linear(weights, bias, threads);
+        linear.set_gemv_max_batch(gemv_max_batch);
+        const ftensor output = linear.forward(input);
+        ASSERT_EQ(output.rows(), batch);
+        ASSERT_EQ(output.cols(), out);
+
+        const arma::fmat expected = input.slice(0) * weights.slice(0).t();
+        for (uint32_t b = 0; b < batch; ++b) {
+            for (uint32_t o = 0; o < out; ++o) {
+                ASSERT_NEAR(output.at(0, b, o), expected.at(b, o) + bias.index(o), 1e-3f) << b << " " << o;
+            }
+        }
+    }
+}
+
+TEST(test_linear, gemv1) {
+    check_linear(1, 37, 19, 1, 1);
+    check_linear(3, 64, 40, 4, 3);
+}
+
+TEST(test_linear, gemm1) {
+    // every tail: batch % 4 and out % 8
+    for (uint32_t batch: {2, 5, 6, 7, 8}) {
+        check_linear(batch, 33, 21, 1, 3);
+    }
+}
+
+TEST(test_linear, vector1) {
+    using namespace wonton;
+    ftensor weights(2, 3);
+    weights.fill({1.f, 2.f, 3.f, 4.f, 5.f, 6.f}, true);
+    ftensor input(3);
+    input.fill({1.f, 0.f, -1.f}, true);
+    const ftensor output = Linear(weights).forward(input);
+    ASSERT_EQ(output.raw_shapes(), std::vector<uint32_t>({2}));
+    ASSERT_EQ(output.index(0), -2.f);
+    ASSERT_EQ(output.index(1), -2.f);
+}
+
+TEST(test_linear, benchmark1) {
+    using namespace wonton;
+    const uint32_t in = 1024, out = 1000;
+    ftensor weights(out, in);
+    weights.rand();
+    const arma::fmat weights_t = weights.slice(0).t();
+    const Linear linear(weights);
+    for (uint32_t batch: {1, 4, 16, 64}) {
+        ftensor input(batch, in);
+        input.rand();
+        ftensor output;
+        arma::fmat expected;
+        const double linear_ms = best_ms([&]() { output = linear.forward(input); }, 5);
+        const double arma_ms = best_ms([&]() { expected = input.slice(0) * weights_t; }, 5);
+        const double gflops = 2e-6 * batch * in * out;
+        LOG(INFO) << "batch " << batch << ": Linear " << linear_ms << "ms (" << gflops / linear_ms << " GFLOP/s)"
+                  << ", arma " << arma_ms << "ms (" << gflops / arma_ms << " GFLOP/s)";
+    }
+}
@@ -0,0 +1,120 @@
+/**
+  *******************************************************
+  * @file           : MemoryTest.cpp
+  * @author         : Mebius
+  * @brief          : test of the memory accounting
+  * @date           : 2024/3/22
+  *******************************************************
+  */
+#include <Test.h>
+#include <Memory.h>
+#include <Convolution.h>
+
+namespace {
+    // the per-scope counters are off by default
+    struct ScopesEnabled {
+        ScopesEnabled() { wonton::MemoryTracker::set_scopes_enabled(true); }
+        ~ScopesEnabled() { wonton::MemoryTracker::set_scopes_enabled(false); }
+    };
+}
+
+TEST(test_memory, live_peak1) {
+    using namespace wonton;
+    MemoryTracker::reset();
+    const uint64_t base = MemoryTracker::stats().live_bytes;
+    {
+        ftensor f1(2, 16, 16);
+        ASSERT_EQ(MemoryTracker::stats().live_bytes, base + 2 * 16 * 16 * sizeof(float));
+        ftensor f2 = f1;    // shares the buffer
+        ASSERT_EQ(MemoryTracker::stats().live_bytes, base + 2 * 16 * 16 * sizeof(float));
+        f2.fill(1.f);       // detaches
+        ASSERT_EQ(MemoryTracker::stats().live_bytes, base + 4 * 16 * 16 * sizeof(float));
+    }
+    const MemoryStats stats = MemoryTracker::stats();
+    ASSERT_EQ(stats.live_bytes, base);
+    ASSERT_EQ(stats.peak_bytes, base + 4 * 16 * 16 * sizeof(float));
+    ASSERT_EQ(stats.allocations, 2);
+}
+
+TEST(test_memory, resize1) {
+    using namespace wonton;
+    const uint64_t base = MemoryTracker::stats().live_bytes;
+    {
+        ftensor f1;
+        f1.data() = arma::fcube(100, 100, 1);
+        f1.index(0) = 1.f;     // the next non-const access records the new size
+        ASSERT_EQ(MemoryTracker::stats().live_bytes, base + 100 * 100 * sizeof(float));
+    }
+    ASSERT_EQ(MemoryTracker::stats().live_bytes, base);
+}
+
+TEST(test_memory, scopes_disabled1) {
+    using namespace wonton;
+    MemoryTracker::reset();
+    MemoryTracker::set_scopes_enabled(false);
+    ftensor f1(3, 8, 8);
+    f1.padding({1, 1, 1, 1}, 0.f);
+    ASSERT_TRUE(MemoryTracker::scope_stats().empty());
+    ASSERT_EQ(MemoryTracker::stats().allocations, 2);
+    // the old buffer is the transient of the padding, even without scopes
+    ASSERT_EQ(MemoryTracker::stats().largest_transient, 3 * 8 * 8 * sizeof(float));
+}
+
+TEST(test_memory, padding_transient1) {
+    using namespace wonton;
+    const ScopesEnabled enabled;
+    MemoryTracker::reset();
+    ftensor f1(3, 8, 8);
+    f1.rand();
+    f1.padding({1, 1, 1, 1}, 0.f);
+
+    const auto scopes = MemoryTracker::scope_stats();
+    ASSERT_EQ(scopes.count("Tensor::padding"), 1);
+    const ScopeMemoryStats &padding = scopes.at("Tensor::padding");
+    ASSERT_EQ(padding.calls, 1);
+    ASSERT_EQ(padding.allocated_bytes, 3 * 10 * 10 * sizeof(float));
+    // the padded tensor is kept, the old buffer is released
+    ASSERT_EQ(padding.retained_bytes, int64_t(3 * 10 * 10 - 3 * 8 * 8) * int64_t(sizeof(float)));
+    ASSERT_EQ(padding.largest_transient, 3 * 8 * 8 * sizeof(float));
+}
+
+TEST(test_memory, nested1) {
+    using namespace wonton;
+    const ScopesEnabled enabled;
+    MemoryTracker::reset();
+    {
+        MemoryScope outer("outer");
+        TrackedBytes kept(100);
+        {
+            MemoryScope inner("inner");
+            TrackedBytes scratch(1000);
+        }
+    }
+    const auto scopes = MemoryTracker::scope_stats();
+    ASSERT_EQ(scopes.at("inner").allocated_bytes, 1000);
+    ASSERT_EQ(scopes.at("inner").largest_transient, 1000);
+    ASSERT_EQ(scopes.at("outer").allocated_bytes, 1100);
+    ASSERT_EQ(scopes.at("outer").peak_bytes, 1100);
+    ASSERT_EQ(scopes.at("outer").retained_bytes, 0);
+}
+
+TEST(test_memory, report1) {
+    using namespace wonton;
+    const ScopesEnabled enabled;
+    MemoryTracker::reset();
+    ftensor input(8, 32, 32);
+    input.rand();
+    std::vector<ftensor> kernels(16, ftensor(8, 3, 3));
+    for (ftensor &kernel: kernels) {
+        kernel.rand();
+    }
+    ConvConfig config;
+    config.algorithm = ConvAlgorithm::kIm2col;
+    const ftensor output = conv2d(input, kernels, ConvParams{1, 1, 1, 1}, config);
+
+    const ScopeMemoryStats conv = MemoryTracker::scope_stats().at("conv2d");
+    // the output is kept, the im2col matrices are transient
+    ASSERT_EQ(conv.retained_bytes, int64_t(output.size() * sizeof(float)));
+    ASSERT_GE(conv.largest_transient, uint64_t(32 * 32) * 8 * 9 * sizeof(float));
+    MemoryTracker::report();
+}
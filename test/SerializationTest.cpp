@@ -0,0 +1,151 @@
+/**
+  *******************************************************
+  * @file           : SerializationTest.cpp
+  * @author         : Mebius
+  * @brief          : test and throughput of the binary tensor format
+  * @date           : 2024/3/18
+  *******************************************************
+  */
+#include <Test.h>
+#include <Serialization.h>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+
+namespace {
+    void expect_same(const wonton::ftensor &a, const wonton::ftensor &b) {
+        ASSERT_EQ(a.raw_shapes(), b.raw_shapes());
+        ASSERT_EQ(a.shapes(), b.shapes());
+        for (uint32_t i = 0; i < a.size(); ++i) {
+            ASSERT_EQ(a.index(i), b.index(i));
+        }
+    }
+}
+
+TEST(test_serialization, round_trip1) {
+    using namespace wonton;
+    std::vector<ftensor> tensors{ftensor(7), ftensor(3, 5), ftensor(4, 3, 2)};
+    ftensor padded(1, 2, 3);
+    padded.padding({1, 1, 1, 1}, 0.f);   // 3-dim raw shape with a single channel
+    tensors.push_back(padded);
+
+    std::stringstream stream;
+    SaveOptions options;
+    options.chunk_bytes = 10;   // several chunks per tensor, not aligned to floats
+    for (auto &tensor: tensors) {
+        tensor.rand();
+        save_tensor(tensor, stream, options);
+    }
+    for (const auto &tensor: tensors) {
+        expect_same(tensor, load_tensor(stream));
+    }
+}
+
+TEST(test_serialization, file_and_fd1) {
+    using namespace wonton;
+    ftensor tensor(3, 16, 16);
+    tensor.rand();
+    const std::string path = testing::TempDir() + "wonton_tensor_test.bin";
+    save_tensor(tensor, path);
+    expect_same(tensor, load_tensor(path));
+
+    FILE *file = std::tmpfile();
+    ASSERT_NE(file, nullptr);
+    save_tensor_fd(tensor, fileno(file));
+    std::rewind(file);
+    expect_same(tensor, load_tensor_fd(fileno(file)));
+    std::fclose(file);
+    std::remove(path.c_str());
+}
+
+TEST(test_serialization, compression1) {
+    using namespace wonton;
+    ftensor tensor(2, 64, 64);
+    tensor.zeros();
+    tensor.at(1, 3, 4) = 1.f;
+    for (Compression compression: {Compression::kZstd, Compression::kLz4}) {
+        std::stringstream stream;
+        SaveOptions options;
+        options.compression = compression;
+        save_tensor(tensor, stream, options);
+        if (compression_available(compression)) {
+            ASSERT_LT(stream.str().size(), tensor.size() * sizeof(float));
+        }
+        expect_same(tensor, load_tensor(stream));
+    }
+}
+
+TEST(test_serialization, corrupt_chunk1) {
+    using namespace wonton;
+    ftensor tensor(4, 3, 2);
+    tensor.rand();
+    std::stringstream stream;
+    save_tensor(tensor, stream);
+    std::string bytes = stream.str();
+    // the stored size of the first chunk claims ~4GiB of an uncompressed stream
+    const uint32_t stored = 0xfffffff0u;
+    std::memcpy(&bytes[40 + 4], &stored, sizeof(stored));
+    std::stringstream corrupt(bytes);
+    ASSERT_DEATH(load_tensor(corrupt), "invalid chunk size");
+}
+
+TEST(test_serialization, corrupt_header1) {
+    using namespace wonton;
+    ftensor tensor(4, 3, 2);
+    tensor.rand();
+    std::stringstream stream;
+    save_tensor(tensor, stream);
+    const std::string bytes = stream.str();
+
+    // rows * cols * channels overflows 32 bits
+    std::string overflow = bytes;
+    const uint32_t rows = 0x40000000u;
+    std::memcpy(&overflow[24], &rows, sizeof(rows));
+    std::stringstream overflow_stream(overflow);
+    ASSERT_DEATH(load_tensor(overflow_stream), "invalid shape");
+
+    // the shape does not match the raw shape
+    std::string mismatch = bytes;
+    const uint32_t cols = 5;
+    std::memcpy(&mismatch[28], &cols, sizeof(cols));
+    std::stringstream mismatch_stream(mismatch);
+    ASSERT_DEATH(load_tensor(mismatch_stream), "invalid shape");
+}
+
+TEST(test_serialization, throughput1) {
+    using namespace wonton;
+    ftensor tensor(4, 256, 256);
+    tensor.rand();
+    const double gigabytes = double(tensor.size() * sizeof(float)) / 1e9;
+    using Clock = std::chrono::steady_clock;
+
+    auto start = Clock::now();
+    std::ostringstream text;
+    for (uint32_t i = 0; i < tensor.channels(); ++i) {
+        text << tensor.slice(i);    // what show() hands to LOG(INFO)
+    }
+    const double text_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    LOG(INFO) << "text: " << gigabytes / text_seconds << " GB/s";
+
+    for (Compression compression: {Compression::kNone, Compression::kZstd, Compression::kLz4}) {
+        if (!compression_available(compression)) {
+            continue;
+        }
+        SaveOptions options;
+        options.compression = compression;
+        std::stringstream stream;
+        start = Clock::now();
+        save_tensor(tensor, stream, options);
+        const double save_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        const size_t stored = stream.str().size();
+        start = Clock::now();
+        const ftensor loaded = load_tensor(stream);
+        const double load_seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        ASSERT_EQ(loaded.size(), tensor.size());
+        LOG(INFO) << "binary compression " << static_cast<int>(compression)
+                  << ": save " << gigabytes / save_seconds << " GB/s"
+                  << ", load " << gigabytes / load_seconds << " GB/s"
+                  << ", ratio " << double(tensor.size() * sizeof(float)) / double(stored);
+    }
+}
@@ -0,0 +1,136 @@
+/**
+  *******************************************************
+  * @file           : SessionTest.cpp
+  * @author         : Mebius
+  * @brief          : test and load generator for InferenceSession
+  * @date           : 2024/3/16
+  *******************************************************
+  */
+#include <Test.h>
+#include <Session.h>
+#include <Memory.h>
+
+TEST(test_session, scatter1) {
+    using namespace wonton;
+    BatchOptions options;
+    options.max_batch_size = 4;
+    options.max_wait = std::chrono::milliseconds(20);
+    std::vector<uint32_t> batch_sizes;
+    InferenceSession session([&batch_sizes](const ftensor &batch, uint32_t batch_size) {
+        batch_sizes.push_back(batch_size);
+        ftensor output = batch;
+        output.transform([](float value) { return value * 2.f; });
+        return output;
+    }, options);
+
+    std::vector<std::future<ftensor>> results;
+    for (uint32_t i = 0; i < 8; ++i) {
+        ftensor input(2, 3, 4);
+        input.fill(float(i));
+        results.push_back(session.submit(input));
+    }
+    for (uint32_t i = 0; i < 8; ++i) {
+        ftensor output = results.at(i).get();
+        ASSERT_EQ(output.shapes(), std::vector<uint32_t>({2, 3, 4}));
+        for (uint32_t j = 0; j < output.size(); ++j) {
+            ASSERT_EQ(output.index(j), float(i) * 2.f);
+        }
+    }
+    session.stop();
+
+    const SessionStats stats = session.stats();
+    ASSERT_EQ(stats.requests, 8);
+    ASSERT_EQ(stats.batches, batch_sizes.size());
+    for (uint32_t batch_size: batch_sizes) {
+        ASSERT_LE(batch_size, 4);
+    }
+}
+
+TEST(test_session, mixed_shapes1) {
+    using namespace wonton;
+    InferenceSession session([](const ftensor &batch, uint32_t) {
+        return batch;
+    });
+    ftensor small(1, 2, 2);
+    small.fill(1.f);
+    ftensor large(1, 3, 3);
+    large.fill(2.f);
+    auto f1 = session.submit(small);
+    auto f2 = session.submit(large);
+    auto f3 = session.submit(small);
+    ASSERT_EQ(f1.get().index(3), 1.f);
+    ASSERT_EQ(f2.get().index(8), 2.f);
+    ASSERT_EQ(f3.get().index(0), 1.f);
+}
+
+TEST(test_session, errors1) {
+    using namespace wonton;
+    InferenceSession session([](const ftensor &batch, uint32_t) {
+        return batch.channels() == 1 ? ftensor() : batch;
+    });
+    ftensor input(1, 2, 2);
+    input.fill(1.f);
+    ASSERT_THROW(session.submit(input).get(), std::runtime_error);
+
+    ftensor valid(2, 2, 2);
+    valid.fill(1.f);
+    ASSERT_EQ(session.submit(valid).get().index(0), 1.f);
+
+    session.stop();
+    ASSERT_THROW(session.submit(valid).get(), std::runtime_error);
+}
+
+namespace {
+    wonton::SessionStats load_generator(uint32_t max_batch_size, uint32_t clients, uint32_t requests_per_client) {
+        using namespace wonton;
+        const uint32_t rows = 32, cols = 32, features = 64;
+        arma::fmat weights(features, rows * cols);
+        weights.fill(0.01f);
+
+        // one GEMM over the whole batch, each channel of each sample is a column
+        auto forward = [&weights, features](const ftensor &batch, uint32_t) {
+            const arma::fmat inputs(const_cast<float *>(batch.data().memptr()), batch.rows() * batch.cols(),
+                                    batch.channels(), false, true);
+            const arma::fmat outputs = weights * inputs;
+            ftensor result(batch.channels(), 1, features);
+            std::copy(outputs.begin(), outputs.end(), result.data().memptr());
+            return result;
+        };
+
+        BatchOptions options;
+        options.max_batch_size = max_batch_size;
+        options.max_wait = std::chrono::microseconds(500);
+        InferenceSession session(forward, options);
+
+        std::vector<std::thread> threads;
+        for (uint32_t c = 0; c < clients; ++c) {
+            threads.emplace_back([&session, requests_per_client, rows, cols]() {
+                ftensor input(3, rows, cols);
+                input.rand();
+                for (uint32_t r = 0; r < requests_per_client; ++r) {
+                    ftensor output = session.submit(input).get();
+                    CHECK_EQ(output.channels(), 3);
+                }
+            });
+        }
+        for (auto &thread: threads) {
+            thread.join();
+        }
+        session.stop();
+        return session.stats();
+    }
+}
+
+TEST(test_session, load_generator1) {
+    for (uint32_t max_batch_size: {1, 4, 16}) {
+        wonton::MemoryTracker::reset_peak();
+        const wonton::SessionStats stats = load_generator(max_batch_size, 16, 32);
+        ASSERT_EQ(stats.requests, 16 * 32);
+        LOG(INFO) << "max batch: " << max_batch_size
+                  << " avg batch: " << stats.avg_batch_size
+                  << " p50: " << stats.p50_latency_ms << "ms"
+                  << " p99: " << stats.p99_latency_ms << "ms"
+                  << " throughput: " << stats.throughput << " req/s"
+                  << " peak memory: " << stats.peak_memory_bytes << " B";
+    }
+}
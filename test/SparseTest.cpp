@@ -0,0 +1,129 @@
+/**
+  *******************************************************
+  * @file           : SparseTest.cpp
+  * @author         : Mebius
+  * @brief          : test and crossover benchmark for sparse weights
+  * @date           : 2024/3/20
+  *******************************************************
+  */
+#include <Test.h>
+#include <Sparse.h>
+#include <random>
+
+namespace {
+    // zero whole 4x4 blocks with probability sparsity, so every format sees the same zeros
+    arma::fmat pruned_matrix(uint32_t rows, uint32_t cols, float sparsity, uint32_t seed) {
+        std::mt19937 engine(seed);
+        std::uniform_real_distribution<float> uniform(0.f, 1.f);
+        std::normal_distribution<float> normal(0.f, 1.f);
+        arma::fmat matrix(rows, cols);
+        for (uint32_t br = 0; br < rows; br += 4) {
+            for (uint32_t bc = 0; bc < cols; bc += 4) {
+                const bool zero = uniform(engine) < sparsity;
+                for (uint32_t r = br; r < std::min(br + 4, rows); ++r) {
+                    for (uint32_t c = bc; c < std::min(bc + 4, cols); ++c) {
+                        matrix.at(r, c) = zero ? 0.f : normal(engine);
+                    }
+                }
+            }
+        }
+        return matrix;
+    }
+
+    arma::fmat random_matrix(uint32_t rows, uint32_t cols) {
+        return pruned_matrix(rows, cols, 0.f, 7);
+    }
+
+    void expect_near(const arma::fmat &a, const arma::fmat &b) {
+        ASSERT_EQ(a.n_rows, b.n_rows);
+        ASSERT_EQ(a.n_cols, b.n_cols);
+        for (uint32_t i = 0; i < a.n_rows; ++i) {
+            for (uint32_t j = 0; j < a.n_cols; ++j) {
+                ASSERT_NEAR(a.at(i, j), b.at(i, j), 1e-3f) << i << " " << j;
+            }
+        }
+    }
+}
+
+TEST(test_sparse, convert1) {
+    using namespace wonton;
+    const arma::fmat dense = pruned_matrix(10, 13, 0.5f, 1);
+    const CsrMatrix csr = CsrMatrix::from_dense(dense);
+    expect_near(csr.to_dense(), dense);
+    ASSERT_GT(csr.sparsity(), 0.f);
+    for (auto block: std::vector<std::pair<uint32_t, uint32_t>>{{1, 4}, {4, 4}, {3, 2}}) {
+        const BlockSparseMatrix bsr = BlockSparseMatrix::from_dense(dense, block.first, block.second);
+        expect_near(bsr.to_dense(), dense);
+        ASSERT_LE(bsr.sparsity(), csr.sparsity());
+    }
+
+    ftensor tensor(3, 4);
+    tensor.fill({0.f, 0.5f, 0.f, 2.f, 0.f, 0.f, 0.f, 0.f, -3.f, 0.f, 0.f, 0.1f}, true);
+    const CsrMatrix pruned = CsrMatrix::from_tensor(tensor, 0.2f);
+    ASSERT_EQ(pruned.nnz(), 3);
+    ASSERT_EQ(pruned.row_offsets(), std::vector<uint32_t>({0, 2, 2, 3}));
+    ASSERT_EQ(pruned.col_indices(), std::vector<uint32_t>({1, 3, 0}));
+}
+
+TEST(test_sparse, spmm1) {
+    using namespace wonton;
+    const arma::fmat a = pruned_matrix(18, 23, 0.6f, 2);
+    const arma::fmat b = random_matrix(23, 7);
+    const arma::fmat expected = a * b;
+    expect_near(spmm(CsrMatrix::from_dense(a), b, 3), expected);
+    for (auto block: std::vector<std::pair<uint32_t, uint32_t>>{{1, 4}, {4, 4}, {3, 2}}) {
+        expect_near(spmm(BlockSparseMatrix::from_dense(a, block.first, block.second), b, 3), expected);
+    }
+}
+
+TEST(test_sparse, conv1) {
+    using namespace wonton;
+    ftensor input(3, 10, 9);
+    input.rand();
+    std::vector<ftensor> kernels;
+    for (uint32_t k = 0; k < 6; ++k) {
+        ftensor kernel(3, 3, 3);
+        kernel.rand();
+        kernel.transform([](float value) { return std::fabs(value) < 0.8f ? 0.f : value; });
+        kernels.push_back(kernel);
+    }
+    ConvParams params;
+    params.pad_h = 1;
+    params.pad_w = 1;
+    params.stride_w = 2;
+    ConvConfig config;
+    config.algorithm = ConvAlgorithm::kDirect;
+    const ftensor expected = conv2d(input, kernels, params, config);
+
+    const arma::fmat weights = kernel_matrix(kernels);
+    std::vector<ftensor> outputs{conv2d(input, CsrMatrix::from_dense(weights), 3, 3, params, 2),
+                                 conv2d(input, BlockSparseMatrix::from_dense(weights, 1, 4), 3, 3, params, 2),
+                                 conv2d(input, BlockSparseMatrix::from_dense(weights, 4, 4), 3, 3, params, 2)};
+    for (const auto &output: outputs) {
+        ASSERT_EQ(output.shapes(), expected.shapes());
+        for (uint32_t i = 0; i < output.size(); ++i) {
+            ASSERT_NEAR(output.index(i), expected.index(i), 1e-3f);
+        }
+    }
+}
+
+TEST(test_sparse, crossover1) {
+    using namespace wonton;
+    const uint32_t m = 256, k = 256, n = 64;
+    const arma::fmat b = random_matrix(k, n);
+    for (float sparsity: {0.f, 0.5f, 0.7f, 0.8f, 0.9f, 0.95f}) {
+        const arma::fmat a = pruned_matrix(m, k, sparsity, 3);
+        const CsrMatrix csr = CsrMatrix::from_dense(a);
+        const BlockSparseMatrix bsr14 = BlockSparseMatrix::from_dense(a, 1, 4);
+        const BlockSparseMatrix bsr44 = BlockSparseMatrix::from_dense(a, 4, 4);
+        arma::fmat out;
+        const double dense_ms = best_ms([&]() { out = a * b; });
+        const double csr_ms = best_ms([&]() { out = spmm(csr, b); });
+        const double bsr14_ms = best_ms([&]() { out = spmm(bsr14, b); });
+        const double bsr44_ms = best_ms([&]() { out = spmm(bsr44, b); });
+        LOG(INFO) << "sparsity " << sparsity << ": dense " << dense_ms << "ms"
+                  << ", csr " << csr_ms << "ms" << (csr_ms < dense_ms ? " (wins)" : "")
+                  << ", bsr1x4 " << bsr14_ms << "ms" << (bsr14_ms < dense_ms ? " (wins)" : "")
+                  << ", bsr4x4 " << bsr44_ms << "ms" << (bsr44_ms < dense_ms ? " (wins)" : "");
+    }
+}
@@ -0,0 +1,123 @@
+/**
+  *******************************************************
+  * @file           : TensorTest3.cpp
+  * @author         : Mebius
+  * @brief          : test for copy-on-write tensors
+  * @date           : 2024/3/19
+  *******************************************************
+  */
+#include <Test.h>
+
+TEST(test_cow, copy1) {
+    using namespace wonton;
+    Tensor<float>::reset_cow_stats();
+    ftensor f1(2, 3, 4);
+    f1.fill(1.f);
+    ftensor f2 = f1;
+    ASSERT_TRUE(f1.shared());
+    ASSERT_EQ(&std::as_const(f1).data(), &std::as_const(f2).data());
+
+    const ftensor f3 = f2;
+    ASSERT_EQ(f3.index(5), 1.f);
+    f2.at(1, 2, 3) = 2.f;
+    ASSERT_FALSE(f2.shared());
+    ASSERT_EQ(f2.at(1, 2, 3), 2.f);
+    ASSERT_EQ(f3.at(1, 2, 3), 1.f);
+    ASSERT_EQ(std::as_const(f1).at(1, 2, 3), 1.f);
+
+    const CowStats stats = Tensor<float>::cow_stats();
+    ASSERT_EQ(stats.shared_copies, 2);
+    ASSERT_EQ(stats.deep_copies, 1);    // only f2.at() copied, f1 and f3 still share
+}
+
+TEST(test_cow, mutators1) {
+    using namespace wonton;
+    ftensor origin(2, 3, 4);
+    origin.fill(1.f);
+    Tensor<float>::reset_cow_stats();
+
+    std::vector<ftensor> copies(7, origin);
+    copies.at(0).fill(2.f);
+    copies.at(1).transform([](float value) { return value + 1.f; });
+    copies.at(2).index(0) = 2.f;
+    copies.at(3).slice(1).fill(2.f);
+    copies.at(4).reshape({4, 3, 2}, true);
+    copies.at(5).padding({1, 1, 1, 1}, 2.f);
+    copies.at(6).rand();
+    for (uint32_t i = 0; i < origin.size(); ++i) {
+        ASSERT_EQ(origin.index(i), 1.f);
+    }
+    ASSERT_EQ(copies.at(1).index(0), 2.f);
+    ASSERT_EQ(copies.at(4).index(23), 1.f);
+
+    // fill, reshape(row major), padding and rand replace the buffer without copying it first
+    const CowStats stats = Tensor<float>::cow_stats();
+    ASSERT_EQ(stats.shared_copies, 7);
+    ASSERT_EQ(stats.deep_copies, 3);
+    ASSERT_EQ(stats.avoided_copies(), 4);
+}
+
+TEST(test_cow, set_data1) {
+    using namespace wonton;
+    ftensor f1(2, 8, 8);
+    arma::fcube cube(8, 8, 2);     // more than arma_config::mat_prealloc elements, moving keeps the memory
+    cube.fill(3.f);
+    const float *memory = cube.memptr();
+    f1.set_data(std::move(cube));
+    ASSERT_EQ(f1.index(7), 3.f);
+    ASSERT_EQ(std::as_const(f1).data().memptr(), memory);
+}
+
+TEST(test_cow, unshareable1) {
+    using namespace wonton;
+    ftensor f1(2, 3, 4);
+    f1.fill(1.f);
+    float &value = f1.index(0);
+    const ftensor f2 = f1;      // deep, value still points into f1
+    value = 7.f;
+    ASSERT_EQ(std::as_const(f1).index(0), 7.f);
+    ASSERT_EQ(f2.index(0), 1.f);
+    ASSERT_FALSE(f1.shared());
+
+    // an in-place rewrite keeps the buffer, the old reference still writes into it
+    f1.fill(2.f);
+    const ftensor f3 = f1;
+    ASSERT_FALSE(f1.shared());
+    value = 9.f;
+    ASSERT_EQ(std::as_const(f1).index(0), 9.f);
+    ASSERT_EQ(f3.index(0), 2.f);
+
+    f1.padding({1, 1, 1, 1}, 0.f);
+    const ftensor f4 = f1;
+    ASSERT_FALSE(f1.shared());
+    ASSERT_EQ(f4.rows(), 5);
+}
+
+TEST(test_cow, padding_keeps_cube1) {
+    using namespace wonton;
+    ftensor f1(2, 3, 4);
+    f1.fill(1.f);
+    arma::fcube &data = f1.data();
+    f1.padding({1, 1, 1, 1}, 0.f);
+    ASSERT_EQ(&data, &f1.data());
+    ASSERT_EQ(data.n_rows, 5);
+    ASSERT_EQ(data.at(1, 1, 0), 1.f);
+
+    // a shared buffer is left to the other owner
+    ftensor f2(2, 3, 4);
+    f2.fill(1.f);
+    const ftensor f3 = f2;
+    f2.padding({1, 1, 1, 1}, 0.f);
+    ASSERT_EQ(f3.rows(), 3);
+    ASSERT_EQ(f2.rows(), 5);
+}
+
+TEST(test_cow, avoided_copies1) {
+    using namespace wonton;
+    ftensor f1(2, 3, 4);
+    ftensor f2 = f1;
+    Tensor<float>::reset_cow_stats();
+    f2.transform([](float value) { return value + 1.f; });
+    ASSERT_EQ(Tensor<float>::cow_stats().deep_copies, 1);
+    ASSERT_EQ(Tensor<float>::cow_stats().avoided_copies(), 0);
+}